@@ -3,9 +3,26 @@
 //#include <boost/hana/>
 #include <tuple>
 #include <vector>
+#include <array>
+#include <memory>
+#include <cstdint>
+#include <cassert>
+#include <utility>
+#include <algorithm>
+#include <typeinfo>
+#include <optional>
+#include <mutex>
+#include <thread>
+#include <string>
+#include <cstring>
+#include <stdexcept>
+#include <chrono>
 #include <type_traits>
-#include <map>
-#include <set>
+
+#include "componentpool.hpp"
+#include "threadpool.hpp"
+#include "componentsnapshot.hpp"
+#include "componentstats.hpp"
 
 template <typename ...T>
 struct SingletonComponent{};
@@ -39,33 +56,510 @@ struct runtime_list{
 template <std::size_t ...indexes, typename ...Args>
 constexpr decltype(auto) gets(std::tuple<Args...>& t){return std::tuple<decltype(get<indexes>(t))&...>(get<indexes>(t)...);};
 
+// query filters, see ComponentManager::tick()
+template <typename T>
+struct Changed{
+    std::uint32_t since;    // component added or marked changed after this tick
+};
+
+template <typename T>
+struct Added{
+    std::uint32_t since;    // component added after this tick
+};
+
 template <typename S, typename N>
 class ComponentManager;
 
 template <typename ...Singletons, typename ...Normals>
 class ComponentManager<SingletonComponent<Singletons...>, NormalComponent<Normals...>>{
 public:
-    using Entities = std::set<std::size_t>;
-    using NormalComponents = std::tuple<std::map<std::size_t, Normals>...>;
+    using Entities = EntityAllocator;
+    // one dense sparse set per component type with change ticks, see componentpool.hpp
+    using NormalComponents = std::tuple<TrackedPool<Normals>...>;
     using SingletonComponents = std::tuple<Singletons...>;
     using SingletonAviliable = std::array<bool, sizeof...(Singletons)>;
+    static_assert(sizeof...(Normals) <= 64, "query masks hold at most 64 normal component types");
+    template <typename T>
+    constexpr static std::uint64_t normalBit = std::uint64_t(1) << type_list_index<T, Normals...>::value;
+    // normal components take bits 0.., singletons the ones after, used by SystemScheduler
+    template <typename T>
+    constexpr static std::uint64_t accessBit(){
+        static_assert(type_list_contains_v<T, Normals...> || type_list_contains_v<T, Singletons...>,
+            "component manager donot contains component of that type");
+        static_assert(sizeof...(Normals) + sizeof...(Singletons) <= 64, "access masks hold at most 64 component types");
+        if constexpr (type_list_contains_v<T, Normals...>)return normalBit<T>;
+        else return std::uint64_t(1) << (sizeof...(Normals) + type_list_index<T, Singletons...>::value);
+    };
+    // persistent result of a multi-component query: matching IDs with the slot of every
+    // requested component, kept up to date by addNormalComponent / removeNormalComponent.
+    // slots moved by the manager's own swap-removes are patched one by one, any other
+    // reordering of a pool rebuilds them all on the next iteration
+    struct QueryCache{
+        const std::type_info* key;
+        std::uint64_t mask;
+        QueryCache(const std::type_info* key, std::uint64_t mask):key(key), mask(mask){};
+        virtual ~QueryCache() = default;
+        virtual void onAdd(ComponentManager& cm, std::size_t ID) = 0;
+        virtual void onRemove(std::size_t ID) = 0;
+        virtual void shrinkToFit() = 0;
+        virtual std::size_t memoryBytes()const = 0;
+        // ID's component of type bit moved to slot while the pool's version went before -> after
+        virtual void onMove(std::uint64_t bit, std::size_t ID, std::uint32_t slot, std::size_t before, std::size_t after) = 0;
+    };
+    template <typename ...ComponentTypes>
+    struct Query : QueryCache{
+        using Slots = std::array<std::uint32_t, sizeof...(ComponentTypes)>;
+        ComponentPool<Slots> matched;
+        std::array<std::size_t, sizeof...(ComponentTypes)> seen;
+        Query(ComponentManager& cm):QueryCache(&typeid(Query), (... | normalBit<ComponentTypes>)){
+            // initial fill walks the smallest pool once
+            const SparseSet* lead = nullptr;
+            (..., (!lead || cm.template pool<ComponentTypes>().size() < lead->size() ? (lead = &cm.template pool<ComponentTypes>()) : lead));
+            for(std::size_t i = 0; i < lead->size(); ++i)onAdd(cm, lead->idAt(i));
+            seen = Query::versions(cm);
+        };
+        static std::array<std::size_t, sizeof...(ComponentTypes)> versions(ComponentManager& cm){
+            return {cm.template pool<ComponentTypes>().version()...};
+        };
+        void onAdd(ComponentManager& cm, std::size_t ID)override{
+            if((cm.template pool<ComponentTypes>().contains(ID) && ...)){
+                matched.emplace(ID, Slots{cm.template pool<ComponentTypes>().slot(ID)...});
+            }
+        };
+        void onRemove(std::size_t ID)override{
+            matched.erase(ID);
+        };
+        void shrinkToFit()override{
+            matched.shrinkToFit();
+        };
+        std::size_t memoryBytes()const override{
+            return matched.memoryBytes();
+        };
+        void onMove(std::uint64_t bit, std::size_t ID, std::uint32_t slot, std::size_t before, std::size_t after)override{
+            constexpr std::array<std::uint64_t, sizeof...(ComponentTypes)> bits{normalBit<ComponentTypes>...};
+            std::size_t k = std::find(bits.begin(), bits.end(), bit) - bits.begin();
+            if(seen[k] != before)return;
+            seen[k] = after;
+            if(Slots* s = matched.find(ID))(*s)[k] = slot;
+        };
+        // sparse lookups done
+        std::size_t refresh(ComponentManager& cm){
+            auto now = Query::versions(cm);
+            if(now == seen)return 0;
+            for(std::size_t i = 0; i < matched.size(); ++i){
+                matched.at(i) = Slots{cm.template pool<ComponentTypes>().slot(matched.idAt(i))...};
+            }
+            seen = now;
+            return matched.size() * sizeof...(ComponentTypes);
+        };
+    };
+    // structural changes recorded on one thread and applied later by applyCommands(),
+    // while systems may still be running. new entities get their handles right away
+    // through an atomic claim, they are alive once the buffer is applied
+    class CommandBuffer{
+        friend class ComponentManager;
+        ComponentManager* cm;
+        std::vector<std::pair<std::size_t, std::size_t>> creates;   // first handle, count
+        std::tuple<std::vector<std::pair<std::size_t, Normals>>...> adds;
+        std::vector<std::pair<std::size_t, std::uint64_t>> changes;  // ID, component mask
+        std::vector<std::pair<std::size_t, std::uint64_t>> removes;
+        std::vector<std::size_t> destroys;
+        std::tuple<std::optional<Singletons>...> singletons;
+        template <typename T>
+        std::vector<std::pair<std::size_t, T>>& addsOf(){
+            return std::get<type_list_index<T, Normals...>::value>(adds);
+        };
+    public:
+        explicit CommandBuffer(ComponentManager& cm):cm(&cm){};
+        template <typename ...Ty>
+        std::size_t createEntity(const Ty& ...components){
+            return createEntities(1, components...);
+        };
+        // n entities with copies of the same components, handles are first + 0 ... first + n - 1
+        template <typename ...Ty>
+        std::size_t createEntities(std::size_t n, const Ty& ...components){
+            std::size_t first = cm->e.claim(n);
+            creates.emplace_back(first, n);
+            (..., addsOf<Ty>().reserve(addsOf<Ty>().size() + n));
+            for(std::size_t i = 0; i < n; ++i)(..., addsOf<Ty>().emplace_back(first + i, components));
+            return first;
+        };
+        template <typename ...Ty>
+        void addNormalComponent(std::size_t ID, const Ty& ...components){
+            static_assert((... && (type_list_contains_v<Ty, Normals...>)), "component manager donot contains normal component of that type");
+            (..., addsOf<Ty>().emplace_back(ID, components));
+        };
+        template <typename ...Ty>
+        void removeNormalComponent(std::size_t ID){
+            static_assert((... && (type_list_contains_v<Ty, Normals...>)), "component manager donot contains normal component of that type");
+            removes.emplace_back(ID, (... | normalBit<Ty>));
+        };
+        template <typename ...Ty>
+        void markChanged(std::size_t ID){
+            static_assert((... && (type_list_contains_v<Ty, Normals...>)), "component manager donot contains normal component of that type");
+            changes.emplace_back(ID, (... | normalBit<Ty>));
+        };
+        void destroyEntity(std::size_t ID){
+            destroys.push_back(ID);
+        };
+        template <typename ...Ty>
+        void addSingletonComponent(const Ty& ...components){
+            static_assert((... && (type_list_contains_v<Ty, Singletons...>)), "component manager donot contains singleton component of that type");
+            (..., (std::get<type_list_index<Ty, Singletons...>::value>(singletons) = components));
+        };
+        bool empty()const{
+            return creates.empty() && changes.empty() && removes.empty() && destroys.empty()
+                && std::apply([](auto& ...v){return (v.empty() && ...);}, adds)
+                && std::apply([](auto& ...v){return (!v && ...);}, singletons);
+        };
+        // keeps capacity for the next frame
+        void clear(){
+            creates.clear();
+            std::apply([](auto& ...v){(..., v.clear());}, adds);
+            changes.clear();
+            removes.clear();
+            destroys.clear();
+            std::apply([](auto& ...v){(..., v.reset());}, singletons);
+        };
+    };
+    // snapshot file mapped read-only, entity table and component arrays are used in place.
+    // a delta holds the IDs removed and the components added or changed since its base
+    class Snapshot{
+        SnapshotReader in;
+        SnapshotHeader h;
+        const EntityAllocator::Slot* slots;
+        const std::uint32_t* freeList;
+        std::size_t slotCount, freeCount;
+        std::array<const std::size_t*, sizeof...(Normals)> removedIDs, IDs;
+        std::array<const void*, sizeof...(Normals)> data;
+        std::array<std::size_t, sizeof...(Normals)> removedCount, count;
+        std::array<const void*, sizeof...(Singletons)> singletons;
+        template <typename T>
+        void readPool(){
+            constexpr std::size_t i = type_list_index<T, Normals...>::value;
+            std::size_t n;
+            removedIDs[i] = in.template array<std::size_t>(removedCount[i]);
+            IDs[i] = in.template array<std::size_t>(count[i]);
+            data[i] = in.template array<T>(n);
+            if(n != count[i])in.fail("component count mismatch");
+        };
+        template <typename T>
+        void readSingleton(){
+            std::size_t n;
+            const T* p = in.template array<T>(n);
+            singletons[type_list_index<T, Singletons...>::value] = n ? p : nullptr;
+        };
+    public:
+        explicit Snapshot(const std::string& path):in(path){
+            static_assert((std::is_trivially_copyable_v<Normals> && ...) && (std::is_trivially_copyable_v<Singletons> && ...),
+                "snapshots need trivially copyable components");
+            h = in.template value<SnapshotHeader>();
+            if(std::memcmp(h.magic, "ECSSNAP", 8) != 0 || h.version != SnapshotVersion)in.fail("not a snapshot of this version");
+            if(h.normals != sizeof...(Normals) || h.singletons != sizeof...(Singletons))in.fail("component types mismatch");
+            constexpr std::array<std::uint64_t, sizeof...(Normals) + sizeof...(Singletons)> sizes{sizeof(Normals)..., sizeof(Singletons)...};
+            for(std::uint64_t size : sizes)if(in.template value<std::uint64_t>() != size)in.fail("component types mismatch");
+            slots = in.template array<EntityAllocator::Slot>(slotCount);
+            freeList = in.template array<std::uint32_t>(freeCount);
+            (..., readPool<Normals>());
+            (..., readSingleton<Singletons>());
+        };
+        bool delta()const{return h.delta != 0;};
+        std::uint32_t tick()const{return static_cast<std::uint32_t>(h.tick);};
+        std::uint32_t base()const{return static_cast<std::uint32_t>(h.base);};
+        std::size_t entitySlots()const{return slotCount;};
+        const EntityAllocator::Slot* entityData()const{return slots;};
+        const std::uint32_t* freeData()const{return freeList;};
+        std::size_t freeSize()const{return freeCount;};
+        template <typename T>
+        std::size_t size()const{return count[type_list_index<T, Normals...>::value];};
+        template <typename T>
+        const std::size_t* ids()const{return IDs[type_list_index<T, Normals...>::value];};
+        template <typename T>
+        const T* components()const{return static_cast<const T*>(data[type_list_index<T, Normals...>::value]);};
+        template <typename T>
+        std::size_t removedSize()const{return removedCount[type_list_index<T, Normals...>::value];};
+        template <typename T>
+        const std::size_t* removed()const{return removedIDs[type_list_index<T, Normals...>::value];};
+        // nullptr when the singleton was not available
+        template <typename T>
+        const T* singleton()const{return static_cast<const T*>(singletons[type_list_index<T, Singletons...>::value]);};
+    };
 private:
     Entities e;
     NormalComponents nc;
     SingletonComponents sc;
     SingletonAviliable sa;
+    std::vector<std::unique_ptr<QueryCache>> queries;
+    std::mutex bufferMutex;
+    std::vector<std::pair<std::thread::id, std::unique_ptr<CommandBuffer>>> buffers;
+    // all adds of one type from every buffer, sorted by entity index and appended in one go
+    template <typename T>
+    void applyAdds(CommandBuffer* const* bs, std::size_t n){
+        auto& all = bs[0]->template addsOf<T>();
+        for(std::size_t i = 1; i < n; ++i){
+            auto& more = bs[i]->template addsOf<T>();
+            all.insert(all.end(), std::make_move_iterator(more.begin()), std::make_move_iterator(more.end()));
+        }
+        if(all.empty())return;
+        auto byIndex = [](const auto& a, const auto& b){return entityIndex(a.first) < entityIndex(b.first);};
+        if(!std::is_sorted(all.begin(), all.end(), byIndex))std::stable_sort(all.begin(), all.end(), byIndex);
+        auto& p = pool<T>();
+        p.reserve(p.size() + all.size());
+        for(auto& [ID, component] : all){
+            if(e.alive(ID) && p.emplace(ID, std::move(component)))componentAdded<T>(ID);
+        }
+    };
+    // order: creates, adds, changes, removes, destroys, singletons. adds to dead entities are dropped,
+    // an existing component wins over an added one like in addNormalComponent
+    void applyBuffers(CommandBuffer* const* bs, std::size_t n){
+        if(n == 0)return;
+        auto begin = std::chrono::steady_clock::now();
+        for(std::size_t i = 0; i < n; ++i){
+            for(auto [first, count] : bs[i]->creates){
+                e.activate(first, count);
+                if constexpr (ComponentStatsEnabled)created += count;
+            }
+        }
+        (..., applyAdds<Normals>(bs, n));
+        for(std::size_t i = 0; i < n; ++i){
+            for(auto [ID, mask] : bs[i]->changes){
+                if(e.alive(ID))(..., ((mask & normalBit<Normals>) ? markChanged<Normals>(ID) : void()));
+            }
+        }
+        for(std::size_t i = 0; i < n; ++i){
+            for(auto [ID, mask] : bs[i]->removes){
+                if(e.alive(ID))(..., ((mask & normalBit<Normals>) ? (void)eraseNormal<Normals>(ID) : void()));
+            }
+        }
+        for(std::size_t i = 0; i < n; ++i){
+            for(std::size_t ID : bs[i]->destroys)destroyEntity(ID);
+        }
+        for(std::size_t i = 0; i < n; ++i){
+            std::apply([this](auto& ...v){(..., (v ? addSingletonComponent(*v) : void()));}, bs[i]->singletons);
+            bs[i]->clear();
+        }
+        e.releaseClaims();
+        if constexpr (ComponentStatsEnabled){
+            ++applies;
+            traceEvents.record("applyCommands", "structural", begin, std::chrono::steady_clock::now());
+        }
+    };
+    // instrumentation, only touched with COMPONENT_STATS
+    std::mutex queryMutex;
+    std::vector<std::unique_ptr<QueryCounters>> queryStats;
+    ComponentTrace traceEvents;
+    std::uint64_t created = 0, destroyed = 0, applies = 0;
+    std::array<std::uint64_t, sizeof...(Normals)> addedCount{}, removedCount{}, changedCount{};
+    std::chrono::steady_clock::time_point born = std::chrono::steady_clock::now(), lastStats = born;
+    std::uint64_t lastCreated = 0, lastDestroyed = 0;
+    std::array<std::uint64_t, sizeof...(Normals)> lastAdded{}, lastRemoved{}, lastChanged{};
+    template <typename Key>
+    QueryCounters* queryCounters(){
+        for(auto& c : queryStats)if(c->key == &typeid(Key))return c.get();
+        std::string name = componentTypeName(typeid(Key));
+        if(name.rfind("std::tuple", 0) == 0)name.replace(0, 10, "query");
+        queryStats.emplace_back(new QueryCounters(&typeid(Key), std::move(name)));
+        return queryStats.back().get();
+    };
+    template <typename Key, typename List>
+    void countQuery(List& list, std::size_t scanned, std::size_t lookups, std::chrono::steady_clock::time_point begin){
+        QueryCounters* c;
+        {
+            std::lock_guard<std::mutex> lock(queryMutex);
+            c = queryCounters<Key>();
+        }
+        c->calls.fetch_add(1, std::memory_order_relaxed);
+        c->scanned.fetch_add(scanned, std::memory_order_relaxed);
+        c->yielded.fetch_add(list.count, std::memory_order_relaxed);
+        c->lookups.fetch_add(lookups, std::memory_order_relaxed);
+        list.timer = QueryTimer(c, &traceEvents, begin);
+    };
+    std::uint32_t currentTick = 1;
+    std::uint32_t snapshotTick = 0;     // tick of the last snapshot saved or loaded, 0 none
+    // just emplaced as the pool's last component
+    template <typename T>
+    void componentAdded(std::size_t ID){
+        auto& p = pool<T>();
+        p.stampAdded(p.size() - 1, currentTick);
+        if constexpr (ComponentStatsEnabled)++addedCount[type_list_index<T, Normals...>::value];
+        for(auto& q : queries)if(q->mask & normalBit<T>)q->onAdd(*this, ID);
+    };
+    // swap-remove, the last component of the pool fills the hole
+    template <typename T>
+    bool eraseNormal(std::size_t ID){
+        auto& p = pool<T>();
+        std::uint32_t s = p.slot(ID);
+        if(s == SparseSet::Null)return false;
+        if(snapshotTick != 0)p.noteRemoved(ID);
+        if constexpr (ComponentStatsEnabled)++removedCount[type_list_index<T, Normals...>::value];
+        for(auto& q : queries)if(q->mask & normalBit<T>)q->onRemove(ID);
+        std::size_t last = p.idAt(p.size() - 1), before = p.version();
+        p.erase(ID);
+        if(last != ID){
+            for(auto& q : queries)if(q->mask & normalBit<T>)q->onMove(normalBit<T>, last, s, before, p.version());
+        }
+        return true;
+    };
+    template <typename T>
+    void savePool(SnapshotWriter& out, bool delta){
+        auto& p = pool<T>();
+        if(!delta){
+            out.array(static_cast<const std::size_t*>(nullptr), 0);
+            out.array(p.idData(), p.size());
+            out.array(p.componentData(), p.size());
+            return;
+        }
+        std::vector<std::size_t> IDs;
+        std::vector<T> changed;
+        p.changedSince(snapshotTick, [&](std::uint32_t s){
+            IDs.push_back(p.idAt(s));
+            changed.push_back(p.at(s));
+        });
+        out.array(p.removed().data(), p.removed().size());
+        out.array(IDs.data(), IDs.size());
+        out.array(changed.data(), changed.size());
+    };
+    template <typename T>
+    void loadChanges(const Snapshot& s){
+        auto& p = pool<T>();
+        for(std::size_t i = 0; i < s.template size<T>(); ++i){
+            std::size_t ID = s.template ids<T>()[i];
+            if(T* c = p.find(ID)){
+                *c = s.template components<T>()[i];
+                markChanged<T>(ID);
+            }else if(e.alive(ID) && p.emplace(ID, s.template components<T>()[i])){
+                componentAdded<T>(ID);
+            }
+        }
+    };
+    template <typename ...ComponentTypes>
+    Query<ComponentTypes...>& query(){
+        for(auto& q : queries)if(q->key == &typeid(Query<ComponentTypes...>))return static_cast<Query<ComponentTypes...>&>(*q);
+        queries.emplace_back(new Query<ComponentTypes...>(*this));
+        return static_cast<Query<ComponentTypes...>&>(*queries.back());
+    };
 public:
-    ComponentManager():e(), nc(), sc(), sa(){
+    ComponentManager():e(), nc(), sc(), sa(), queries(), bufferMutex(), buffers(){
         sa.fill(false);
     };
+    // new entity, optionally with components
+    template <typename ...Ty>
+    std::size_t createEntity(const Ty& ...components){
+        std::size_t ID = e.create();
+        if constexpr (ComponentStatsEnabled)++created;
+        if constexpr (sizeof...(Ty) != 0)addNormalComponent(ID, components...);
+        return ID;
+    };
+    // removes all components, the handle and its copies become stale. false if already stale
+    bool destroyEntity(std::size_t ID){
+        if(!e.alive(ID))return false;
+        (..., eraseNormal<Normals>(ID));
+        if constexpr (ComponentStatsEnabled)++destroyed;
+        return e.destroy(ID);
+    };
+    bool alive(std::size_t ID)const{return e.alive(ID);};
+    std::size_t entityCount()const{return e.size();};
+    // ID must come from createEntity and be alive
     template <typename ...Ty>
     void addNormalComponent(std::size_t ID, const Ty& ...components){
         static_assert((... && (type_list_contains_v<Ty, Normals...>)), "component manager donot contains normal component of that type");
-        int tmp[sizeof...(Ty)] = {(
-            get<type_list_index<Ty, Normals...>::value>(nc).emplace(ID, components),
-            0
-        )...};
-        e.emplace(ID);
+        assert(e.alive(ID));
+        (..., (pool<Ty>().emplace(ID, components) ? componentAdded<Ty>(ID) : void()));
+    };
+    // missing components are ignored
+    template <typename ...Ty>
+    void removeNormalComponent(std::size_t ID){
+        static_assert((... && (type_list_contains_v<Ty, Normals...>)), "component manager donot contains normal component of that type");
+        assert(e.alive(ID));
+        (..., eraseNormal<Ty>(ID));
+    };
+    template <typename T>
+    bool hasNormalComponent(std::size_t ID){
+        return pool<T>().contains(ID);
+    };
+    // the calling thread's buffer, created on first use and applied by applyCommands().
+    // keep the reference instead of calling this per entity
+    CommandBuffer& commands(){
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        auto self = std::this_thread::get_id();
+        for(auto& [id, b] : buffers)if(id == self)return *b;
+        buffers.emplace_back(self, std::make_unique<CommandBuffer>(*this));
+        return *buffers.back().second;
+    };
+    // sync point: applies every per-thread buffer as one batch, no system may run meanwhile
+    void applyCommands(){
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        std::vector<CommandBuffer*> bs;
+        for(auto& [id, b] : buffers)bs.push_back(b.get());
+        applyBuffers(bs.data(), bs.size());
+    };
+    void applyCommands(CommandBuffer& buffer){
+        CommandBuffer* b = &buffer;
+        applyBuffers(&b, 1);
+    };
+    // writes entities, normal components and singletons in one streaming pass, returns the
+    // snapshot's tick. delta: only what changed since the previous snapshot saved or loaded,
+    // the entity table is always written whole. changes must be reported with markChanged
+    std::uint32_t saveSnapshot(const std::string& path, bool delta=false){
+        static_assert((std::is_trivially_copyable_v<Normals> && ...) && (std::is_trivially_copyable_v<Singletons> && ...),
+            "snapshots need trivially copyable components");
+        if(delta && snapshotTick == 0)throw std::runtime_error("snapshot: delta without a base snapshot '" + path + "'");
+        auto begin = std::chrono::steady_clock::now();
+        SnapshotWriter out(path);
+        SnapshotHeader h{};
+        std::memcpy(h.magic, "ECSSNAP", 8);
+        h.version = SnapshotVersion;
+        h.delta = delta;
+        h.tick = currentTick;
+        h.base = delta ? snapshotTick : 0;
+        h.normals = sizeof...(Normals);
+        h.singletons = sizeof...(Singletons);
+        out.value(h);
+        (..., out.value(static_cast<std::uint64_t>(sizeof(Normals))));
+        (..., out.value(static_cast<std::uint64_t>(sizeof(Singletons))));
+        out.array(e.slotData(), e.capacity());
+        out.array(e.freeData(), e.freeCount());
+        (..., savePool<Normals>(out, delta));
+        (..., out.array(&std::get<type_list_index<Singletons, Singletons...>::value>(sc), hasSingletonComponent<Singletons>() ? 1 : 0));
+        out.finish();
+        (..., pool<Normals>().clearRemoved());
+        snapshotTick = advanceTick();
+        if constexpr (ComponentStatsEnabled)traceEvents.record("saveSnapshot", "snapshot", begin, std::chrono::steady_clock::now());
+        return snapshotTick;
+    };
+    // full snapshot: replaces everything, cached queries and pending command buffers are
+    // dropped and change tracking starts over. delta: must follow the snapshot it was taken
+    // against, applied through the normal add / remove paths so queries and ticks see it
+    void loadSnapshot(const std::string& path){
+        auto begin = std::chrono::steady_clock::now();
+        Snapshot s(path);
+        if(!s.delta()){
+            e.assign(s.entityData(), s.entitySlots(), s.freeData(), s.freeSize());
+            (..., pool<Normals>().assign(s.template ids<Normals>(), s.template components<Normals>(), s.template size<Normals>()));
+            queries.clear();
+            for(auto& [id, b] : buffers)b->clear();
+        }else{
+            if(s.base() != snapshotTick)throw std::runtime_error("snapshot: delta does not follow the current state '" + path + "'");
+            currentTick = std::max(currentTick, s.tick());
+            (..., [&]{
+                for(std::size_t i = 0; i < s.template removedSize<Normals>(); ++i)eraseNormal<Normals>(s.template removed<Normals>()[i]);
+            }());
+            e.assign(s.entityData(), s.entitySlots(), s.freeData(), s.freeSize());
+            (..., loadChanges<Normals>(s));
+        }
+        (..., [&]{
+            const Singletons* p = s.template singleton<Singletons>();
+            if(p)std::get<type_list_index<Singletons, Singletons...>::value>(sc) = *p;
+            sa[type_list_index<Singletons, Singletons...>::value] = p != nullptr;
+        }());
+        currentTick = std::max(currentTick, s.tick());
+        snapshotTick = advanceTick();
+        if constexpr (ComponentStatsEnabled)traceEvents.record("loadSnapshot", "snapshot", begin, std::chrono::steady_clock::now());
+    };
+    // releases capacity left behind by removed components, live handles stay valid
+    void shrinkToFit(){
+        std::apply([](auto& ...p){(..., p.shrinkToFit());}, nc);
+        for(auto& q : queries)q->shrinkToFit();
     };
     template <typename ...Ty>
     void addSingletonComponent(const Ty& ...components){
@@ -76,47 +570,160 @@ public:
             0
         )...};
     }
+    // stamp of changes made now. a system reading with Changed<T>{last} stores
+    // last = advanceTick() when done, so later changes are seen on its next run
+    std::uint32_t tick()const{return currentTick;};
+    // ends the current tick and returns it
+    std::uint32_t advanceTick(){return currentTick++;};
+    // writes through references from queries are not seen, report them here.
+    // main thread only, worker threads use CommandBuffer::markChanged
+    template <typename ...Ty>
+    void markChanged(std::size_t ID){
+        static_assert((... && (type_list_contains_v<Ty, Normals...>)), "component manager donot contains normal component of that type");
+        (..., [&]{
+            std::uint32_t s = pool<Ty>().slot(ID);
+            if(s == SparseSet::Null)return;
+            pool<Ty>().touch(s, currentTick);
+            if constexpr (ComponentStatsEnabled)++changedCount[type_list_index<Ty, Normals...>::value];
+        }());
+    };
+    template <typename T>
+    TrackedPool<T>& pool(){
+        return std::get<type_list_index<T, Normals...>::value>(nc);
+    };
+    // matching entities only, components are reached through cached slots without lookups.
+    // a single component type walks its pool directly. invalidated by structural changes
     template <typename ...ComponentTypes>
     struct EntityList{
-        EntityList(ComponentManager* cm):cm(cm){};
+        using Slots = std::array<std::uint32_t, sizeof...(ComponentTypes)>;
         ComponentManager* cm;
+        const std::size_t* ids;
+        const Slots* slots;     // nullptr: dense order of the only pool
+        std::size_t count;
+        // filtered results own their IDs and slots, copies share them
+        std::shared_ptr<const std::pair<std::vector<std::size_t>, std::vector<Slots>>> owned;
+        [[no_unique_address]] std::conditional_t<ComponentStatsEnabled, QueryTimer, std::tuple<>> timer;
+        std::size_t size()const{return count;};
+        template <std::size_t ...I>
+        decltype(auto) at(std::size_t i, std::index_sequence<I...>){
+            return std::tuple<const std::size_t, ComponentTypes&...>(
+                ids[i],
+                cm->template pool<ComponentTypes>().at(slots ? slots[i][I] : i)...
+            );
+        };
+        decltype(auto) operator[](std::size_t i){
+            return at(i, std::index_sequence_for<ComponentTypes...>{});
+        };
         struct ComponentIterator{
-            ComponentManager* cm;
-            Entities::iterator current_entity;
-            bool aviliable(){
-                auto current_entity_ID = *current_entity;
-                return ((std::get<type_list_index<ComponentTypes, Normals...>::value>(cm->nc).find(current_entity_ID)
-                        !=std::get<type_list_index<ComponentTypes, Normals...>::value>(cm->nc).end()) && ...);
-            };
-            void operator++(){
-                do{
-                    ++current_entity;
-                }while(current_entity!=cm->e.end()&&!aviliable());
-            };
-            decltype(auto) operator*(){
-                auto current_entity_ID = *current_entity;
-                return std::tuple<const std::size_t, ComponentTypes&...>(
-                    current_entity_ID,
-                    std::get<type_list_index<ComponentTypes, Normals...>::value>(cm->nc).find(current_entity_ID)->second...
-                );
-            };
-            bool operator!=(const ComponentIterator& other){return cm != other.cm || current_entity != other.current_entity;};
+            EntityList* list;
+            std::size_t current;
+            void operator++(){++current;};
+            decltype(auto) operator*(){return (*list)[current];};
+            bool operator!=(const ComponentIterator& other){return list != other.list || current != other.current;};
         };
         ComponentIterator begin(){
-            ComponentIterator tmp{cm, cm->e.begin()};
-            if(!cm->e.empty()&&!tmp.aviliable())++tmp;
-            return tmp;
+            return ComponentIterator{this, 0};
         };
         ComponentIterator end(){
-            return ComponentIterator{cm, cm->e.end()};
+            return ComponentIterator{this, count};
+        };
+        // entities touched per chunk so that one chunk's IDs, slots and components fit in L1
+        constexpr static std::size_t DefaultGrain = std::max<std::size_t>(64,
+            (std::size_t(16) << 10) / (sizeof(std::size_t) + sizeof(Slots) + (sizeof(ComponentTypes) + ...)));
+        // fn(ID, components...) on the pool's threads, chunks of grain entities.
+        // every call gets a different entity, so writing its components needs no locking.
+        // structural changes from inside fn are not allowed
+        template <typename F>
+        void par_for_each(F&& fn, std::size_t grain=DefaultGrain, bool deterministic=false, ThreadPool& pool=ThreadPool::global()){
+            pool.parallelFor(count, grain, [&](std::size_t begin, std::size_t end, std::size_t){
+                for(std::size_t i = begin; i < end; ++i)std::apply(fn, (*this)[i]);
+            }, deterministic);
         };
     };
     template <typename ...ComponentTypes>
     decltype(auto) getNormalComponent(){
         static_assert((... && type_list_contains_v<ComponentTypes, Normals...>),
             "component manager donot contains normal component of that type");
-        return EntityList<ComponentTypes...>(this);
+        auto begin = std::chrono::steady_clock::now();
+        EntityList<ComponentTypes...> list;
+        std::size_t lookups = 0;
+        if constexpr (sizeof...(ComponentTypes) == 1){
+            auto& p = pool<ComponentTypes...>();
+            list = EntityList<ComponentTypes...>{this, p.idData(), nullptr, p.size()};
+        }else{
+            // queries may be built or refreshed by systems running in parallel
+            std::lock_guard<std::mutex> lock(queryMutex);
+            auto& q = query<ComponentTypes...>();
+            lookups = q.refresh(*this);
+            list = EntityList<ComponentTypes...>{this, q.matched.idData(), q.matched.componentData(), q.matched.size()};
+        }
+        if constexpr (ComponentStatsEnabled)countQuery<std::tuple<ComponentTypes...>>(list, list.count, lookups, begin);
+        return list;
+    };
+    // entities with all ComponentTypes whose F component was changed (Changed) or added (Added)
+    // after filter.since. cost is proportional to the changes of F, oldest change first
+    template <typename ...ComponentTypes, template <typename> typename Filter, typename F>
+    EntityList<ComponentTypes...> getNormalComponent(Filter<F> filter){
+        static_assert((... && type_list_contains_v<ComponentTypes, Normals...>) && type_list_contains_v<F, Normals...>,
+            "component manager donot contains normal component of that type");
+        static_assert(std::is_same_v<Filter<F>, Changed<F>> || std::is_same_v<Filter<F>, Added<F>>, "unknown query filter");
+        using Slots = typename EntityList<ComponentTypes...>::Slots;
+        auto begin = std::chrono::steady_clock::now();
+        auto result = std::make_shared<std::pair<std::vector<std::size_t>, std::vector<Slots>>>();
+        auto& p = pool<F>();
+        std::size_t scanned = 0;
+        std::lock_guard<std::mutex> lock(queryMutex);
+        p.changedSince(filter.since, [&](std::uint32_t s){
+            ++scanned;
+            if constexpr (std::is_same_v<Filter<F>, Added<F>>){
+                if(p.addedTick(s) <= filter.since)return;
+            }
+            std::size_t ID = p.idAt(s);
+            Slots slots{pool<ComponentTypes>().slot(ID)...};
+            if(std::find(slots.begin(), slots.end(), SparseSet::Null) != slots.end())return;
+            result->first.push_back(ID);
+            result->second.push_back(slots);
+        });
+        EntityList<ComponentTypes...> list{this, result->first.data(), result->second.data(), result->first.size(), result};
+        if constexpr (ComponentStatsEnabled)countQuery<std::tuple<Filter<F>, ComponentTypes...>>(list, scanned, scanned * sizeof...(ComponentTypes), begin);
+        return list;
+    };
+    // counters of every query, memory and entity counts of every store, structural change
+    // rates since the previous call. counters and rates stay 0 without COMPONENT_STATS
+    ComponentStatsSnapshot statsSnapshot(){
+        auto now = std::chrono::steady_clock::now();
+        double dt = std::chrono::duration<double>(now - lastStats).count();
+        auto rate = [dt](std::uint64_t cur, std::uint64_t& last){
+            double r = dt > 0 ? static_cast<double>(cur - last) / dt : 0;
+            last = cur;
+            return r;
+        };
+        ComponentStatsSnapshot r{};
+        r.seconds = std::chrono::duration<double>(now - born).count();
+        r.entities = e.size();
+        r.entityBytes = e.memoryBytes();
+        r.created = created;
+        r.destroyed = destroyed;
+        r.applies = applies;
+        r.createdRate = rate(created, lastCreated);
+        r.destroyedRate = rate(destroyed, lastDestroyed);
+        (..., [&]{
+            constexpr std::size_t i = type_list_index<Normals, Normals...>::value;
+            r.types.push_back(ComponentStatsSnapshot::Type{componentTypeName(typeid(Normals)), pool<Normals>().size(), pool<Normals>().memoryBytes(),
+                addedCount[i], removedCount[i], changedCount[i],
+                rate(addedCount[i], lastAdded[i]), rate(removedCount[i], lastRemoved[i]), rate(changedCount[i], lastChanged[i])});
+        }());
+        std::lock_guard<std::mutex> lock(queryMutex);
+        for(auto& q : queries)r.queryBytes += q->memoryBytes();
+        for(auto& c : queryStats){
+            r.queries.push_back(ComponentStatsSnapshot::Query{c->name, c->calls.load(), c->scanned.load(), c->yielded.load(), c->lookups.load(),
+                static_cast<double>(c->nanoseconds.load()) * 1e-9});
+        }
+        lastStats = now;
+        return r;
     };
+    // Chrome trace recorder: trace().start(), run frames, trace().dump(path)
+    ComponentTrace& trace(){return traceEvents;};
     template <typename ...ComponentTypes>
     bool hasSingletonComponent(){
         static_assert((... && type_list_contains_v<ComponentTypes, Singletons...>),
@@ -0,0 +1,425 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <utility>
+#include <algorithm>
+#include <atomic>
+
+// entity IDs are handles: index in the low 32 bits, generation in the high 32 bits.
+// sparse sets are indexed by the index part and compare the whole handle, so a handle
+// of a destroyed entity never matches the entity reusing its index
+constexpr std::size_t EntityIndexBits = 32;
+constexpr std::size_t EntityIndexMask = (std::size_t(1) << EntityIndexBits) - 1;
+static_assert(sizeof(std::size_t) * 8 >= 2 * EntityIndexBits, "entity handles need 64-bit std::size_t");
+
+inline std::size_t entityIndex(std::size_t ID){return ID & EntityIndexMask;};
+inline std::uint32_t entityGeneration(std::size_t ID){return static_cast<std::uint32_t>(ID >> EntityIndexBits);};
+inline std::size_t entityHandle(std::size_t index, std::uint32_t generation){
+    return (static_cast<std::size_t>(generation) << EntityIndexBits) | index;
+};
+
+// paged sparse set: entity ID -> dense slot through fixed-size pages allocated on demand,
+// the IDs are packed in a dense array. lookup is two loads, iteration is a linear scan,
+// removal swaps the last slot in.
+class SparseSet{
+public:
+    constexpr static std::size_t PageBits = 12;
+    constexpr static std::size_t PageSize = std::size_t(1) << PageBits;
+    constexpr static std::uint32_t Null = ~std::uint32_t(0);
+
+protected:
+    std::vector<std::unique_ptr<std::uint32_t[]>> sparse;
+    std::vector<std::size_t> ids;
+    std::size_t moves = 0;
+
+    std::uint32_t& entry(std::size_t id){
+        id = entityIndex(id);
+        std::size_t p = id >> PageBits;
+        if(p >= sparse.size())sparse.resize(p + 1);
+        if(!sparse[p]){
+            sparse[p].reset(new std::uint32_t[PageSize]);
+            std::fill_n(sparse[p].get(), PageSize, Null);
+        }
+        return sparse[p][id & (PageSize - 1)];
+    };
+
+    // payload arrays of derived pools follow every move of the IDs
+    virtual void swapData(std::size_t, std::size_t){};
+    virtual void popData(){};
+    virtual void shrinkData(){};
+
+public:
+    SparseSet() = default;
+    SparseSet(SparseSet&&) = default;
+    SparseSet& operator=(SparseSet&&) = default;
+    virtual ~SparseSet() = default;
+
+    std::size_t size()const{return ids.size();};
+    bool empty()const{return ids.empty();};
+
+    // dense slot of id, Null when absent or stored under another generation
+    std::uint32_t slot(std::size_t id)const{
+        std::size_t index = entityIndex(id), p = index >> PageBits;
+        if(p >= sparse.size() || !sparse[p])return Null;
+        std::uint32_t s = sparse[p][index & (PageSize - 1)];
+        return s != Null && ids[s] == id ? s : Null;
+    };
+
+    bool contains(std::size_t id)const{return slot(id) != Null;};
+
+    // appends id, false when already present
+    bool insert(std::size_t id){
+        std::uint32_t& s = entry(id);
+        if(s != Null){
+            assert(ids[s] == id && "index still held by an older generation");
+            return false;
+        }
+        assert(ids.size() < Null);
+        s = static_cast<std::uint32_t>(ids.size());
+        ids.push_back(id);
+        return true;
+    };
+
+    // exchanges two slots, ID mapping and payload included
+    void swapSlots(std::size_t a, std::size_t b){
+        if(a == b)return;
+        std::swap(ids[a], ids[b]);
+        entry(ids[a]) = static_cast<std::uint32_t>(a);
+        entry(ids[b]) = static_cast<std::uint32_t>(b);
+        swapData(a, b);
+        ++moves;
+    };
+
+    // moves the last slot into the hole, false when absent
+    bool erase(std::size_t id){
+        std::uint32_t s = slot(id);
+        if(s == Null)return false;
+        swapSlots(s, ids.size() - 1);
+        entry(id) = Null;
+        ids.pop_back();
+        popData();
+        return true;
+    };
+
+    // replaces the contents with n IDs in that slot order
+    void assign(const std::size_t* src, std::size_t n){
+        sparse.clear();
+        ids.assign(src, src + n);
+        for(std::size_t i = 0; i < n; ++i){
+            std::uint32_t& s = entry(ids[i]);
+            assert(s == Null && "duplicate entity index");
+            s = static_cast<std::uint32_t>(i);
+        }
+        ++moves;
+    };
+
+    // frees unused capacity and sparse pages without live entries, slots stay as they are
+    void shrinkToFit(){
+        ids.shrink_to_fit();
+        shrinkData();
+        for(auto& page : sparse){
+            if(page && std::all_of(page.get(), page.get() + PageSize, [](std::uint32_t s){return s == Null;}))page.reset();
+        }
+        while(!sparse.empty() && !sparse.back())sparse.pop_back();
+        sparse.shrink_to_fit();
+    };
+
+    // heap bytes held, capacity included
+    virtual std::size_t memoryBytes()const{
+        std::size_t pages = 0;
+        for(auto& page : sparse)pages += page != nullptr;
+        return sparse.capacity() * sizeof(sparse[0]) + pages * PageSize * sizeof(std::uint32_t) + ids.capacity() * sizeof(std::size_t);
+    };
+
+    // bumped whenever existing entries change slot, appends keep it
+    std::size_t version()const{return moves;};
+
+    const std::size_t* idData()const{return ids.data();};
+    std::size_t idAt(std::size_t slot)const{return ids[slot];};
+};
+
+// sparse set with the components packed in a second dense array, slot i of the ID array
+// and of the component array belong to the same entity
+template <typename T>
+class ComponentPool : public SparseSet{
+    std::vector<T> data;
+
+protected:
+    void swapData(std::size_t a, std::size_t b)override{
+        using std::swap;
+        swap(data[a], data[b]);
+    };
+    void popData()override{data.pop_back();};
+    void shrinkData()override{data.shrink_to_fit();};
+
+public:
+    T* find(std::size_t id){
+        std::uint32_t s = slot(id);
+        return s == Null ? nullptr : &data[s];
+    };
+
+    const T* find(std::size_t id)const{
+        std::uint32_t s = slot(id);
+        return s == Null ? nullptr : &data[s];
+    };
+
+    T& get(std::size_t id){
+        assert(contains(id));
+        return data[slot(id)];
+    };
+
+    const T& get(std::size_t id)const{
+        assert(contains(id));
+        return data[slot(id)];
+    };
+
+    // like std::map::emplace: an existing component is kept and false returned
+    template <typename ...Args>
+    bool emplace(std::size_t id, Args&& ...args){
+        if(!insert(id))return false;
+        data.emplace_back(std::forward<Args>(args)...);
+        return true;
+    };
+
+    void reserve(std::size_t n){
+        ids.reserve(n);
+        data.reserve(n);
+    };
+
+    void assign(const std::size_t* src, const T* components, std::size_t n){
+        SparseSet::assign(src, n);
+        data.assign(components, components + n);
+    };
+
+    std::size_t memoryBytes()const override{
+        return SparseSet::memoryBytes() + data.capacity() * sizeof(T);
+    };
+
+    T* componentData(){return data.data();};
+    const T* componentData()const{return data.data();};
+
+    T& at(std::size_t slot){return data[slot];};
+    const T& at(std::size_t slot)const{return data[slot];};
+};
+
+// hands out entity handles, destroyed indexes are reused LIFO with the generation bumped.
+// generations wrap after 2^32 reuses of one index.
+// claim() reserves fresh indexes from any thread, the handles turn alive on activate();
+// releaseClaims() recycles claims that were never activated
+class EntityAllocator{
+public:
+    struct Slot{
+        std::uint32_t generation;
+        std::uint32_t alive;
+    };
+
+private:
+    std::vector<Slot> slots;
+    std::vector<std::uint32_t> freeList;
+    std::size_t count = 0;
+    std::atomic<std::size_t> tail{0};   // fresh indexes handed out, claims included
+    std::size_t synced = 0;             // claims below were activated or recycled
+
+    Slot& grow(std::size_t index){
+        if(index >= slots.size())slots.resize(index + 1, Slot{0, 0});
+        return slots[index];
+    };
+
+public:
+    // not concurrent with claim()
+    std::size_t create(){
+        std::size_t index;
+        if(!freeList.empty()){
+            index = freeList.back();
+            freeList.pop_back();
+        }else{
+            index = tail.fetch_add(1, std::memory_order_relaxed);
+            assert(index < EntityIndexMask);
+            grow(index);
+        }
+        slots[index].alive = 1;
+        ++count;
+        return entityHandle(index, slots[index].generation);
+    };
+
+    // false for stale or unknown handles
+    bool destroy(std::size_t ID){
+        if(!alive(ID))return false;
+        Slot& s = slots[entityIndex(ID)];
+        s.alive = 0;
+        ++s.generation;
+        freeList.push_back(static_cast<std::uint32_t>(entityIndex(ID)));
+        --count;
+        return true;
+    };
+
+    // first of n consecutive generation 0 handles, thread safe
+    std::size_t claim(std::size_t n=1){
+        std::size_t index = tail.fetch_add(n, std::memory_order_relaxed);
+        assert(index + n <= EntityIndexMask);
+        return entityHandle(index, 0);
+    };
+
+    // the n handles starting at first, as returned by claim(n)
+    void activate(std::size_t first, std::size_t n=1){
+        assert(entityGeneration(first) == 0);
+        if(n == 0)return;
+        grow(first + n - 1);
+        for(std::size_t i = first; i < first + n; ++i){
+            assert(!slots[i].alive && slots[i].generation == 0);
+            slots[i].alive = 1;
+        }
+        count += n;
+    };
+
+    // claimed but never activated indexes go to the free list, their handles stay stale
+    void releaseClaims(){
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        if(t > slots.size())grow(t - 1);
+        for(std::size_t i = synced; i < t; ++i){
+            // destroyed entities already moved past generation 0
+            if(slots[i].alive || slots[i].generation != 0)continue;
+            ++slots[i].generation;
+            freeList.push_back(static_cast<std::uint32_t>(i));
+        }
+        synced = t;
+    };
+
+    bool alive(std::size_t ID)const{
+        std::size_t index = entityIndex(ID);
+        return index < slots.size() && slots[index].alive && slots[index].generation == entityGeneration(ID);
+    };
+
+    std::size_t size()const{return count;};
+    // indexes handed out so far, live or free
+    std::size_t capacity()const{return slots.size();};
+
+    void reserve(std::size_t n){slots.reserve(n);};
+
+    std::size_t memoryBytes()const{return slots.capacity() * sizeof(Slot) + freeList.capacity() * sizeof(std::uint32_t);};
+
+    const Slot* slotData()const{return slots.data();};
+    const std::uint32_t* freeData()const{return freeList.data();};
+    std::size_t freeCount()const{return freeList.size();};
+
+    // state saved from slotData() / freeData(), no claims may be pending
+    void assign(const Slot* s, std::size_t n, const std::uint32_t* free, std::size_t nfree){
+        slots.assign(s, s + n);
+        freeList.assign(free, free + nfree);
+        count = static_cast<std::size_t>(std::count_if(slots.begin(), slots.end(), [](const Slot& x){return x.alive != 0;}));
+        tail.store(n, std::memory_order_relaxed);
+        synced = n;
+    };
+};
+
+// component pool remembering when each component was added and last changed.
+// every change appends (tick, ID) to a log unless the component was already touched in
+// that tick, so changedSince(T) walks only the log entries newer than T. the log drops
+// superseded and removed entries once it grows past twice the pool size
+template <typename T>
+class TrackedPool : public ComponentPool<T>{
+    std::vector<std::uint32_t> addedTicks, changedTicks;
+    std::vector<std::pair<std::uint32_t, std::size_t>> changeLog;
+    std::vector<std::uint32_t> visited;     // per slot, dedups one changedSince walk
+    std::uint32_t visitEpoch = 0;
+    std::vector<std::size_t> removedIDs;
+
+    // components emplaced through ComponentPool directly start at tick 0
+    void sync(){
+        addedTicks.resize(this->size(), 0);
+        changedTicks.resize(this->size(), 0);
+    };
+
+    void compact(){
+        auto live = [this](const std::pair<std::uint32_t, std::size_t>& c){
+            std::uint32_t s = this->slot(c.second);
+            return s != SparseSet::Null && s < changedTicks.size() && changedTicks[s] == c.first;
+        };
+        changeLog.erase(std::stable_partition(changeLog.begin(), changeLog.end(), live), changeLog.end());
+    };
+
+protected:
+    void swapData(std::size_t a, std::size_t b)override{
+        ComponentPool<T>::swapData(a, b);
+        sync();
+        std::swap(addedTicks[a], addedTicks[b]);
+        std::swap(changedTicks[a], changedTicks[b]);
+    };
+    void popData()override{
+        ComponentPool<T>::popData();
+        sync();
+    };
+    void shrinkData()override{
+        ComponentPool<T>::shrinkData();
+        compact();
+        addedTicks.shrink_to_fit();
+        changedTicks.shrink_to_fit();
+        changeLog.shrink_to_fit();
+        visited.clear();
+        visited.shrink_to_fit();
+    };
+
+public:
+    std::uint32_t addedTick(std::size_t slot)const{return slot < addedTicks.size() ? addedTicks[slot] : 0;};
+    std::uint32_t changedTick(std::size_t slot)const{return slot < changedTicks.size() ? changedTicks[slot] : 0;};
+
+    // ticks must not decrease from call to call
+    void touch(std::size_t slot, std::uint32_t tick){
+        sync();
+        if(changedTicks[slot] == tick)return;
+        changedTicks[slot] = tick;
+        changeLog.emplace_back(tick, this->idAt(slot));
+        if(changeLog.size() > 2 * this->size() + 1024)compact();
+    };
+
+    void stampAdded(std::size_t slot, std::uint32_t tick){
+        sync();
+        addedTicks[slot] = tick;
+        touch(slot, tick);
+    };
+
+    // fn(slot) once for every component changed after tick since, oldest change first
+    template <typename F>
+    void changedSince(std::uint32_t since, F&& fn){
+        auto it = std::partition_point(changeLog.begin(), changeLog.end(), [since](const auto& c){return c.first <= since;});
+        if(it == changeLog.end())return;
+        sync();
+        visited.resize(this->size(), 0);
+        if(++visitEpoch == 0){
+            std::fill(visited.begin(), visited.end(), 0);
+            visitEpoch = 1;
+        }
+        for(; it != changeLog.end(); ++it){
+            std::uint32_t s = this->slot(it->second);
+            if(s == SparseSet::Null || changedTicks[s] != it->first || visited[s] == visitEpoch)continue;
+            visited[s] = visitEpoch;
+            fn(s);
+        }
+    };
+
+    std::size_t logSize()const{return changeLog.size();};
+
+    std::size_t memoryBytes()const override{
+        return ComponentPool<T>::memoryBytes() + (addedTicks.capacity() + changedTicks.capacity() + visited.capacity()) * sizeof(std::uint32_t)
+            + changeLog.capacity() * sizeof(changeLog[0]) + removedIDs.capacity() * sizeof(std::size_t);
+    };
+
+    // IDs whose component was removed, kept for delta snapshots until clearRemoved()
+    void noteRemoved(std::size_t ID){removedIDs.push_back(ID);};
+    const std::vector<std::size_t>& removed()const{return removedIDs;};
+    void clearRemoved(){removedIDs.clear();};
+
+    // bulk load, change tracking starts over at tick 0
+    void assign(const std::size_t* src, const T* components, std::size_t n){
+        ComponentPool<T>::assign(src, components, n);
+        addedTicks.assign(n, 0);
+        changedTicks.assign(n, 0);
+        changeLog.clear();
+        visited.clear();
+        removedIDs.clear();
+    };
+};
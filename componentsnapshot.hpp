@@ -0,0 +1,110 @@
+#pragma once
+
+// binary snapshot format of ComponentManager, see ComponentManager::saveSnapshot.
+// header, type table, entity table, one section per normal component type, singletons.
+// every array starts on a 64-byte boundary so a mapped file can be used in place.
+// errors throw std::runtime_error
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <stdexcept>
+
+#include "mappedfile.hpp"
+
+constexpr std::size_t SnapshotAlign = 64;
+constexpr std::uint32_t SnapshotVersion = 1;
+
+struct SnapshotHeader{
+    char magic[8];                  // "ECSSNAP"
+    std::uint32_t version;
+    std::uint32_t delta;            // 0 full, 1 changes since the snapshot at base
+    std::uint64_t tick;             // world tick the snapshot was taken at
+    std::uint64_t base;
+    std::uint32_t normals;          // type table: normals + singletons element sizes follow
+    std::uint32_t singletons;
+};
+
+// one streaming pass, arrays padded to SnapshotAlign
+class SnapshotWriter{
+    std::ofstream out;
+    std::string path;
+    std::size_t offset = 0;
+
+public:
+    explicit SnapshotWriter(const std::string& path):out(path, std::ios::binary | std::ios::trunc), path(path){
+        if(!out)throw std::runtime_error("snapshot: cannot open '" + path + "'");
+    };
+
+    void write(const void* p, std::size_t bytes){
+        out.write(static_cast<const char*>(p), static_cast<std::streamsize>(bytes));
+        offset += bytes;
+    };
+
+    template <typename T>
+    void value(const T& v){write(&v, sizeof(T));};
+
+    // count, padding, then count elements
+    template <typename T>
+    void array(const T* p, std::size_t count){
+        value(static_cast<std::uint64_t>(count));
+        pad();
+        write(p, count * sizeof(T));
+    };
+
+    void pad(){
+        static const char zeros[SnapshotAlign] = {};
+        write(zeros, (SnapshotAlign - offset % SnapshotAlign) % SnapshotAlign);
+    };
+
+    void finish(){
+        out.flush();
+        if(!out)throw std::runtime_error("snapshot: write failed '" + path + "'");
+        out.close();
+    };
+};
+
+// bounds-checked cursor over a read-only mapping, arrays are returned in place
+class SnapshotReader{
+    MappedFile file;
+    std::string path;
+    std::size_t offset = 0;
+
+    const char* take(std::size_t bytes){
+        if(bytes > file.size() - offset)throw std::runtime_error("snapshot: truncated '" + path + "'");
+        const char* p = static_cast<const char*>(file.data()) + offset;
+        offset += bytes;
+        return p;
+    };
+
+public:
+    explicit SnapshotReader(const std::string& path):file(path, MappedFile::Mode::Read), path(path){
+        file.adviseSequential();
+    };
+
+    template <typename T>
+    T value(){
+        T v;
+        std::memcpy(&v, take(sizeof(T)), sizeof(T));
+        return v;
+    };
+
+    template <typename T>
+    const T* array(std::size_t& count){
+        std::uint64_t n = value<std::uint64_t>();
+        pad();
+        if(n > (file.size() - offset) / (sizeof(T) ? sizeof(T) : 1))throw std::runtime_error("snapshot: truncated '" + path + "'");
+        count = static_cast<std::size_t>(n);
+        return reinterpret_cast<const T*>(take(count * sizeof(T)));
+    };
+
+    void pad(){
+        take((SnapshotAlign - offset % SnapshotAlign) % SnapshotAlign);
+    };
+
+    [[noreturn]] void fail(const std::string& what)const{
+        throw std::runtime_error("snapshot: " + what + " '" + path + "'");
+    };
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+// opt-in instrumentation of ComponentManager, compiled in with -DCOMPONENT_STATS.
+// without it every hook is an `if constexpr` on a false constant and costs nothing, the
+// snapshot then only has what can be read off the stores (entity counts and memory).
+// counters: per query calls, entities scanned / yielded, sparse lookups and time from
+// getNormalComponent until its EntityList dies; per component type adds, removes and
+// change marks; entity creates / destroys. rates are per second since the previous snapshot.
+// the trace records the same query scopes, command applies, snapshots and scheduled systems
+// as Chrome trace events, open the dump in chrome://tracing or ui.perfetto.dev
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <typeinfo>
+#if defined(__GNUG__)
+#include <cxxabi.h>
+#include <cstdlib>
+#endif
+
+#ifdef COMPONENT_STATS
+constexpr bool ComponentStatsEnabled = true;
+#else
+constexpr bool ComponentStatsEnabled = false;
+#endif
+
+inline std::string componentTypeName(const std::type_info& t){
+#if defined(__GNUG__)
+    int status = 0;
+    char* s = abi::__cxa_demangle(t.name(), nullptr, nullptr, &status);
+    if(status == 0 && s){
+        std::string r(s);
+        std::free(s);
+        return r;
+    }
+#endif
+    return t.name();
+};
+
+struct ComponentStatsSnapshot{
+    struct Type{
+        std::string name;
+        std::size_t count;
+        std::size_t bytes;
+        std::uint64_t added, removed, changed;      // totals
+        double addedRate, removedRate, changedRate; // per second
+    };
+    struct Query{
+        std::string name;
+        std::uint64_t calls, scanned, yielded, lookups;
+        double seconds;
+    };
+    double seconds;             // since the manager was created
+    std::size_t entities;
+    std::size_t entityBytes;
+    std::size_t queryBytes;     // cached query results
+    std::uint64_t created, destroyed, applies;
+    double createdRate, destroyedRate;
+    std::vector<Type> types;
+    std::vector<Query> queries;
+};
+
+struct QueryCounters{
+    const std::type_info* key;
+    std::string name;
+    std::atomic<std::uint64_t> calls{0}, scanned{0}, yielded{0}, lookups{0}, nanoseconds{0};
+    QueryCounters(const std::type_info* key, std::string name):key(key), name(std::move(name)){};
+};
+
+// Chrome trace "complete" events, recorded only between start() and stop()
+class ComponentTrace{
+    struct Event{
+        std::string name;
+        const char* category;
+        std::int64_t begin, duration;     // nanoseconds since epoch
+        std::uint32_t thread;
+    };
+    std::mutex m;
+    std::vector<Event> events;
+    std::atomic<bool> recording{false};
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    static std::uint32_t threadNumber(){
+        static std::atomic<std::uint32_t> next{0};
+        thread_local std::uint32_t n = next++;
+        return n;
+    };
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void start(){recording = true;};
+    void stop(){recording = false;};
+    bool active()const{return recording.load(std::memory_order_relaxed);};
+    void clear(){
+        std::lock_guard<std::mutex> lock(m);
+        events.clear();
+    };
+
+    void record(std::string name, const char* category, Clock::time_point begin, Clock::time_point end){
+        if(!active())return;
+        Event e{std::move(name), category,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(begin - epoch).count(),
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count(), threadNumber()};
+        std::lock_guard<std::mutex> lock(m);
+        events.push_back(std::move(e));
+    };
+
+    // JSON object format, timestamps in microseconds
+    void dump(const std::string& path){
+        std::ofstream out(path, std::ios::trunc);
+        if(!out)throw std::runtime_error("trace: cannot open '" + path + "'");
+        std::lock_guard<std::mutex> lock(m);
+        out << "{\"traceEvents\":[";
+        for(std::size_t i = 0; i < events.size(); ++i){
+            const Event& e = events[i];
+            std::string name;
+            for(char c : e.name){
+                if(c == '"' || c == '\\')name += '\\';
+                name += c;
+            }
+            out << (i ? ",\n" : "\n") << "{\"name\":\"" << name << "\",\"cat\":\"" << e.category
+                << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.thread
+                << ",\"ts\":" << e.begin / 1000 << '.' << (e.begin % 1000) / 100
+                << ",\"dur\":" << e.duration / 1000 << '.' << (e.duration % 1000) / 100 << '}';
+        }
+        out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+        if(!out)throw std::runtime_error("trace: write failed '" + path + "'");
+    };
+};
+
+// measures from construction to destruction into a query's counters and the trace.
+// moves hand the measurement over, copies do not measure
+class QueryTimer{
+    QueryCounters* counters = nullptr;
+    ComponentTrace* trace = nullptr;
+    ComponentTrace::Clock::time_point begin;
+
+public:
+    QueryTimer() = default;
+    QueryTimer(QueryCounters* counters, ComponentTrace* trace, ComponentTrace::Clock::time_point begin)
+        :counters(counters), trace(trace), begin(begin){};
+    QueryTimer(const QueryTimer&){};
+    QueryTimer& operator=(const QueryTimer&){return *this;};
+    QueryTimer(QueryTimer&& other):counters(other.counters), trace(other.trace), begin(other.begin){
+        other.counters = nullptr;
+    };
+    QueryTimer& operator=(QueryTimer&& other){
+        std::swap(counters, other.counters);
+        std::swap(trace, other.trace);
+        std::swap(begin, other.begin);
+        return *this;
+    };
+    ~QueryTimer(){
+        if(!counters)return;
+        auto end = ComponentTrace::Clock::now();
+        counters->nanoseconds.fetch_add(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count()), std::memory_order_relaxed);
+        trace->record(counters->name, "query", begin, end);
+    };
+};
@@ -0,0 +1,310 @@
+#ifndef _SRC_LINEARALGEBRA_ALLOCATOR_H__
+#define _SRC_LINEARALGEBRA_ALLOCATOR_H__
+
+#include <cstddef>
+#include <cassert>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+// allocators for the heap_mat _Alloc parameter, e.g. heap_mat<64, 64, float, pool_allocator>.
+// both are stateless (all instances compare equal) and hand out 64-byte-aligned blocks.
+// pool_allocator: power-of-two size classes, per-thread free lists in front of a shared pool,
+//                 blocks are never returned to the system until pool_release().
+// arena_allocator: bump pointer in a per-thread arena, released in bulk by arena_scope / arena_reset().
+// alloc_stats() counts every call that reaches the system heap, steady-state loops should see none.
+
+constexpr size_t ALLOC_ALIGN = 64;
+
+struct alloc_counters{
+    size_t system_allocs;
+    size_t system_frees;
+    size_t system_bytes;
+};
+
+inline std::atomic<size_t> g_alloc_system_allocs{0};
+inline std::atomic<size_t> g_alloc_system_frees{0};
+inline std::atomic<size_t> g_alloc_system_bytes{0};
+
+inline alloc_counters alloc_stats(){
+    return {g_alloc_system_allocs.load(std::memory_order_relaxed),
+            g_alloc_system_frees.load(std::memory_order_relaxed),
+            g_alloc_system_bytes.load(std::memory_order_relaxed)};
+};
+
+inline void alloc_stats_reset(){
+    g_alloc_system_allocs.store(0, std::memory_order_relaxed);
+    g_alloc_system_frees.store(0, std::memory_order_relaxed);
+    g_alloc_system_bytes.store(0, std::memory_order_relaxed);
+};
+
+inline void* alloc_system(size_t bytes){
+    g_alloc_system_allocs.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_system_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    return ::operator new(bytes, std::align_val_t(ALLOC_ALIGN));
+};
+
+inline void alloc_system_free(void* p){
+    g_alloc_system_frees.fetch_add(1, std::memory_order_relaxed);
+    ::operator delete(p, std::align_val_t(ALLOC_ALIGN));
+};
+
+// ---------------------------------------------------------------- pool
+
+// classes 64B .. 256MB, bigger requests go straight to the system
+constexpr size_t POOL_MIN_SHIFT = 6;
+constexpr size_t POOL_CLASSES = 23;
+// bytes a thread keeps per class before spilling half to the shared pool
+constexpr size_t POOL_CACHE_BYTES = size_t(4) << 20;
+
+inline size_t pool_class(size_t bytes){
+    size_t c = 0;
+    while((size_t(1) << (c + POOL_MIN_SHIFT)) < bytes)++c;
+    return c;
+};
+
+constexpr size_t pool_class_bytes(size_t c){return size_t(1) << (c + POOL_MIN_SHIFT);};
+
+// free blocks are linked through their first word
+struct pool_block{
+    pool_block* next;
+};
+
+struct pool_list{
+    pool_block* head = nullptr;
+    size_t count = 0;
+
+    void push(void* p){
+        pool_block* b = static_cast<pool_block*>(p);
+        b->next = head;
+        head = b;
+        ++count;
+    };
+
+    void* pop(){
+        pool_block* b = head;
+        head = b->next;
+        --count;
+        return b;
+    };
+};
+
+// blocks freed by exiting threads or spilled from full caches
+struct pool_shared{
+    std::mutex lock[POOL_CLASSES];
+    pool_list list[POOL_CLASSES];
+};
+
+// intentionally leaked, so heap_mat statics may still free into it at exit
+inline pool_shared& pool_global(){
+    static pool_shared* g = new pool_shared();
+    return *g;
+};
+
+inline void* pool_global_take(size_t c){
+    pool_shared& g = pool_global();
+    std::lock_guard<std::mutex> guard(g.lock[c]);
+    return g.list[c].head ? g.list[c].pop() : nullptr;
+};
+
+inline void pool_global_give(size_t c, void* p){
+    pool_shared& g = pool_global();
+    std::lock_guard<std::mutex> guard(g.lock[c]);
+    g.list[c].push(p);
+};
+
+inline thread_local bool pool_cache_dead = false;
+
+struct pool_thread_cache{
+    pool_list list[POOL_CLASSES];
+
+    static size_t limit(size_t c){return std::max<size_t>(2, POOL_CACHE_BYTES / pool_class_bytes(c));};
+
+    void* take(size_t c){
+        if(list[c].head)return list[c].pop();
+        if(void* p = pool_global_take(c))return p;
+        return alloc_system(pool_class_bytes(c));
+    };
+
+    void give(size_t c, void* p){
+        list[c].push(p);
+        if(list[c].count > limit(c)){
+            pool_shared& g = pool_global();
+            std::lock_guard<std::mutex> guard(g.lock[c]);
+            while(list[c].count > limit(c) / 2)g.list[c].push(list[c].pop());
+        }
+    };
+
+    ~pool_thread_cache(){
+        pool_shared& g = pool_global();
+        for(size_t c = 0; c < POOL_CLASSES; ++c){
+            std::lock_guard<std::mutex> guard(g.lock[c]);
+            while(list[c].head)g.list[c].push(list[c].pop());
+        }
+        pool_cache_dead = true;
+    };
+};
+
+// nullptr once this thread's cache is destroyed, callers fall back to the shared pool
+inline pool_thread_cache* pool_cache(){
+    if(pool_cache_dead)return nullptr;
+    static thread_local pool_thread_cache cache;
+    return &cache;
+};
+
+inline void* pool_alloc(size_t bytes){
+    size_t c = pool_class(bytes);
+    if(c >= POOL_CLASSES)return alloc_system(bytes);
+    if(pool_thread_cache* cache = pool_cache())return cache->take(c);
+    if(void* p = pool_global_take(c))return p;
+    return alloc_system(pool_class_bytes(c));
+};
+
+inline void pool_free(void* p, size_t bytes){
+    size_t c = pool_class(bytes);
+    if(c >= POOL_CLASSES){
+        alloc_system_free(p);
+    }else if(pool_thread_cache* cache = pool_cache()){
+        cache->give(c, p);
+    }else{
+        pool_global_give(c, p);
+    }
+};
+
+// hand this thread's cached blocks and the shared pool back to the system
+inline void pool_release(){
+    pool_shared& g = pool_global();
+    pool_thread_cache* cache = pool_cache();
+    for(size_t c = 0; c < POOL_CLASSES; ++c){
+        std::lock_guard<std::mutex> guard(g.lock[c]);
+        while(cache && cache->list[c].head)alloc_system_free(cache->list[c].pop());
+        while(g.list[c].head)alloc_system_free(g.list[c].pop());
+    }
+};
+
+template <typename T>
+struct pool_allocator{
+    using value_type = T;
+
+    pool_allocator() = default;
+    template <typename U>
+    pool_allocator(const pool_allocator<U>&){};
+
+    T* allocate(size_t n){return static_cast<T*>(pool_alloc(n * sizeof(T)));};
+    void deallocate(T* p, size_t n){pool_free(p, n * sizeof(T));};
+
+    template <typename U>
+    bool operator==(const pool_allocator<U>&)const{return true;};
+    template <typename U>
+    bool operator!=(const pool_allocator<U>&)const{return false;};
+};
+
+// ---------------------------------------------------------------- arena
+
+constexpr size_t ARENA_CHUNK = size_t(1) << 20;
+
+// chunks are kept after a rewind, so a repeated frame reuses the same memory
+class frame_arena{
+    struct chunk{
+        char* base;
+        size_t size;
+    };
+    std::vector<chunk> chunks;
+    size_t cur = 0;     // chunk being bumped
+    size_t top = 0;     // offset in chunks[cur]
+
+public:
+    struct marker{
+        size_t cur, top;
+    };
+
+    frame_arena() = default;
+    frame_arena(const frame_arena&) = delete;
+    frame_arena& operator=(const frame_arena&) = delete;
+
+    ~frame_arena(){
+        for(auto& c : chunks)alloc_system_free(c.base);
+    };
+
+    void* allocate(size_t bytes){
+        bytes = (bytes + ALLOC_ALIGN - 1) / ALLOC_ALIGN * ALLOC_ALIGN;
+        while(cur < chunks.size()){
+            if(top + bytes <= chunks[cur].size){
+                void* p = chunks[cur].base + top;
+                top += bytes;
+                return p;
+            }
+            ++cur;
+            top = 0;
+        }
+        size_t size = std::max(ARENA_CHUNK, bytes);
+        chunks.push_back({static_cast<char*>(alloc_system(size)), size});
+        cur = chunks.size() - 1;
+        top = bytes;
+        return chunks[cur].base;
+    };
+
+    // only the most recent block is actually reclaimed, anything else waits for rewind
+    void deallocate(void* p, size_t bytes){
+        bytes = (bytes + ALLOC_ALIGN - 1) / ALLOC_ALIGN * ALLOC_ALIGN;
+        if(cur < chunks.size() && top >= bytes && static_cast<char*>(p) == chunks[cur].base + top - bytes){
+            top -= bytes;
+        }
+    };
+
+    marker mark()const{return {cur, top};};
+    void rewind(marker m){
+        assert(m.cur <= chunks.size());
+        cur = m.cur;
+        top = m.top;
+    };
+    void reset(){rewind({0, 0});};
+
+    size_t reserved()const{
+        size_t n = 0;
+        for(auto& c : chunks)n += c.size;
+        return n;
+    };
+
+    static frame_arena& local(){
+        static thread_local frame_arena arena;
+        return arena;
+    };
+};
+
+// everything allocated by arena_allocator on this thread during the scope is freed at its end,
+// matrices allocated inside must not outlive it
+class arena_scope{
+    frame_arena& arena;
+    frame_arena::marker m;
+public:
+    arena_scope():arena(frame_arena::local()), m(arena.mark()){};
+    arena_scope(const arena_scope&) = delete;
+    arena_scope& operator=(const arena_scope&) = delete;
+    ~arena_scope(){arena.rewind(m);};
+};
+
+// for frame loops without a scope object: call once per frame after the last temporary is gone
+inline void arena_reset(){frame_arena::local().reset();};
+
+// blocks belong to the allocating thread's arena, freeing on another thread is a no-op
+template <typename T>
+struct arena_allocator{
+    using value_type = T;
+
+    arena_allocator() = default;
+    template <typename U>
+    arena_allocator(const arena_allocator<U>&){};
+
+    T* allocate(size_t n){return static_cast<T*>(frame_arena::local().allocate(n * sizeof(T)));};
+    void deallocate(T* p, size_t n){frame_arena::local().deallocate(p, n * sizeof(T));};
+
+    template <typename U>
+    bool operator==(const arena_allocator<U>&)const{return true;};
+    template <typename U>
+    bool operator!=(const arena_allocator<U>&)const{return false;};
+};
+
+#endif
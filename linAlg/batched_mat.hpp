@@ -0,0 +1,283 @@
+#ifndef _SRC_LINEARALGEBRA_BATCHED_MAT_H__
+#define _SRC_LINEARALGEBRA_BATCHED_MAT_H__
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include "mat.hpp"
+
+// n independent d1 x d2 matrices stored structure-of-arrays:
+// plane (i, j) holds element (i, j) of every matrix contiguously, planes are
+// stride() apart, so every kernel runs a simd loop across the batch.
+
+// lanes handled by one parallel work item, keeps all planes of a chunk in L1
+constexpr size_t BATCH_CHUNK = 256;
+// planes start on 64-byte boundaries relative to the buffer
+constexpr size_t BATCH_ALIGN_BYTES = 64;
+
+template <size_t d1, size_t d2, typename E=DEFAULT_ELEMENT, template <typename T> typename _Alloc=DEFAULT_ALLOCATOR>
+class batched_mat{
+public:
+    constexpr static size_t lane_align = std::max<size_t>(1, BATCH_ALIGN_BYTES / sizeof(E));
+private:
+    size_t n;
+    size_t st;
+    std::vector<E, _Alloc<E>> data;
+public:
+    explicit batched_mat(size_t n=0):n(n), st((n + lane_align - 1) / lane_align * lane_align), data(d1 * d2 * st){};
+
+    batched_mat(size_t n, const mat<d1, d2, E>& init):batched_mat(n){
+        for(size_t i = 0; i < d1; ++i){
+            for(size_t j = 0; j < d2; ++j)std::fill_n(plane(i, j), n, init.e[i][j]);
+        }
+    };
+
+    explicit batched_mat(const std::vector<mat<d1, d2, E>>& src):batched_mat(src.size()){
+        #pragma omp parallel for
+        for(size_t b0 = 0; b0 < n; b0 += BATCH_CHUNK){
+            size_t b1 = std::min(n, b0 + BATCH_CHUNK);
+            for(size_t i = 0; i < d1; ++i){
+                for(size_t j = 0; j < d2; ++j){
+                    E* p = plane(i, j);
+                    for(size_t b = b0; b < b1; ++b)p[b] = src[b].e[i][j];
+                }
+            }
+        }
+    };
+
+    size_t size()const{return n;};
+    size_t stride()const{return st;};
+
+    E* plane(size_t i, size_t j){return data.data() + (i * d2 + j) * st;};
+    const E* plane(size_t i, size_t j)const{return data.data() + (i * d2 + j) * st;};
+
+    mat<d1, d2, E> get(size_t b)const{
+        assert(b < n);
+        mat<d1, d2, E> ret;
+        for(size_t i = 0; i < d1; ++i){
+            for(size_t j = 0; j < d2; ++j)ret.e[i][j] = plane(i, j)[b];
+        }
+        return ret;
+    };
+
+    void set(size_t b, const mat<d1, d2, E>& m){
+        assert(b < n);
+        for(size_t i = 0; i < d1; ++i){
+            for(size_t j = 0; j < d2; ++j)plane(i, j)[b] = m.e[i][j];
+        }
+    };
+
+    std::vector<mat<d1, d2, E>> to_vector()const{
+        std::vector<mat<d1, d2, E>> ret(n);
+        #pragma omp parallel for
+        for(size_t b0 = 0; b0 < n; b0 += BATCH_CHUNK){
+            size_t b1 = std::min(n, b0 + BATCH_CHUNK);
+            for(size_t i = 0; i < d1; ++i){
+                for(size_t j = 0; j < d2; ++j){
+                    const E* p = plane(i, j);
+                    for(size_t b = b0; b < b1; ++b)ret[b].e[i][j] = p[b];
+                }
+            }
+        }
+        return ret;
+    };
+
+    batched_mat operator+(const batched_mat& other)const{
+        batched_mat res(n);
+        batched_mat_add(*this, other, res);
+        return res;
+    };
+
+    batched_mat operator-(const batched_mat& other)const{
+        batched_mat res(n);
+        batched_mat_sub(*this, other, res);
+        return res;
+    };
+
+    template <size_t d3>
+    batched_mat<d1, d3, E, _Alloc> operator*(const batched_mat<d2, d3, E, _Alloc>& other)const{
+        batched_mat<d1, d3, E, _Alloc> res(n);
+        batched_mat_mul(*this, other, res);
+        return res;
+    };
+
+    batched_mat<d2, d1, E, _Alloc> transpose()const{
+        batched_mat<d2, d1, E, _Alloc> res(n);
+        batched_mat_transpose(*this, res);
+        return res;
+    };
+
+    batched_mat inverse()const{
+        batched_mat res(n);
+        batched_mat_inverse(*this, res);
+        return res;
+    };
+
+    std::vector<E> det()const{
+        std::vector<E> res(n);
+        batched_mat_det(*this, res.data());
+        return res;
+    };
+};
+
+// the kernels below write into preallocated storage, t may alias an operand
+// only where noted, sizes must match
+
+// t = a + b / a - b, t may alias a or b
+template <size_t d1, size_t d2, typename E, template <typename T> typename _Alloc>
+void batched_mat_addsub(const batched_mat<d1, d2, E, _Alloc>& a, const batched_mat<d1, d2, E, _Alloc>& b,
+                        batched_mat<d1, d2, E, _Alloc>& t, bool sub){
+    assert(a.size() == b.size() && a.size() == t.size());
+    size_t n = a.size();
+    #pragma omp parallel for
+    for(size_t b0 = 0; b0 < n; b0 += BATCH_CHUNK){
+        size_t b1 = std::min(n, b0 + BATCH_CHUNK);
+        for(size_t ij = 0; ij < d1 * d2; ++ij){
+            const E* x = a.plane(0, 0) + ij * a.stride();
+            const E* y = b.plane(0, 0) + ij * b.stride();
+            E* z = t.plane(0, 0) + ij * t.stride();
+            if(sub){
+                #pragma omp simd
+                for(size_t l = b0; l < b1; ++l)z[l] = x[l] - y[l];
+            }else{
+                #pragma omp simd
+                for(size_t l = b0; l < b1; ++l)z[l] = x[l] + y[l];
+            }
+        }
+    }
+};
+
+template <size_t d1, size_t d2, typename E, template <typename T> typename _Alloc>
+void batched_mat_add(const batched_mat<d1, d2, E, _Alloc>& a, const batched_mat<d1, d2, E, _Alloc>& b, batched_mat<d1, d2, E, _Alloc>& t){
+    batched_mat_addsub(a, b, t, false);
+};
+
+template <size_t d1, size_t d2, typename E, template <typename T> typename _Alloc>
+void batched_mat_sub(const batched_mat<d1, d2, E, _Alloc>& a, const batched_mat<d1, d2, E, _Alloc>& b, batched_mat<d1, d2, E, _Alloc>& t){
+    batched_mat_addsub(a, b, t, true);
+};
+
+// t = a * b for every matrix of the batch, t must not alias a or b
+template <size_t d1, size_t d2, size_t d3, typename E, template <typename T> typename _Alloc>
+void batched_mat_mul(const batched_mat<d1, d2, E, _Alloc>& a, const batched_mat<d2, d3, E, _Alloc>& b, batched_mat<d1, d3, E, _Alloc>& t){
+    assert(a.size() == b.size() && a.size() == t.size());
+    size_t n = a.size();
+    #pragma omp parallel for
+    for(size_t b0 = 0; b0 < n; b0 += BATCH_CHUNK){
+        size_t b1 = std::min(n, b0 + BATCH_CHUNK);
+        for(size_t i = 0; i < d1; ++i){
+            for(size_t k = 0; k < d3; ++k){
+                E* z = t.plane(i, k);
+                const E* x0 = a.plane(i, 0);
+                const E* y0 = b.plane(0, k);
+                #pragma omp simd
+                for(size_t l = b0; l < b1; ++l)z[l] = x0[l] * y0[l];
+                for(size_t j = 1; j < d2; ++j){
+                    const E* x = a.plane(i, j);
+                    const E* y = b.plane(j, k);
+                    #pragma omp simd
+                    for(size_t l = b0; l < b1; ++l)z[l] += x[l] * y[l];
+                }
+            }
+        }
+    }
+};
+
+// plane (i, j) -> plane (j, i), t must not alias a
+template <size_t d1, size_t d2, typename E, template <typename T> typename _Alloc>
+void batched_mat_transpose(const batched_mat<d1, d2, E, _Alloc>& a, batched_mat<d2, d1, E, _Alloc>& t){
+    assert(a.size() == t.size());
+    #pragma omp parallel for
+    for(size_t ij = 0; ij < d1 * d2; ++ij){
+        size_t i = ij / d2, j = ij % d2;
+        std::copy_n(a.plane(i, j), a.size(), t.plane(j, i));
+    }
+};
+
+// W lanes of the batch as one value, lets the scalar closed forms of mat_small.hpp
+// run element-wise across the batch
+template <typename E, size_t W>
+struct batch_lanes{
+    E v[W];
+
+    batch_lanes() = default;
+    explicit batch_lanes(E x){
+        #pragma omp simd
+        for(size_t l = 0; l < W; ++l)v[l] = x;
+    };
+
+    #define BATCH_LANES_OP(op) \
+    friend batch_lanes operator op(const batch_lanes& a, const batch_lanes& b){ \
+        batch_lanes r; \
+        _Pragma("omp simd") \
+        for(size_t l = 0; l < W; ++l)r.v[l] = a.v[l] op b.v[l]; \
+        return r; \
+    };
+    BATCH_LANES_OP(+)
+    BATCH_LANES_OP(-)
+    BATCH_LANES_OP(*)
+    BATCH_LANES_OP(/)
+    #undef BATCH_LANES_OP
+
+    friend batch_lanes operator-(const batch_lanes& a){
+        batch_lanes r;
+        #pragma omp simd
+        for(size_t l = 0; l < W; ++l)r.v[l] = -a.v[l];
+        return r;
+    };
+};
+
+// lanes per batch_lanes value, 32 bytes: wider blocks spill the 4x4 closed form out of registers
+template <typename E>
+constexpr size_t BATCH_LANES = std::max<size_t>(1, 32 / sizeof(E));
+
+// runs f(x, y) on W-lane blocks of every d x d matrix of a, scatters y into t,
+// the ragged tail goes through a zero-padded block
+template <size_t d, typename E, template <typename T> typename _Alloc, typename F>
+void batched_mat_square_apply(const batched_mat<d, d, E, _Alloc>& a, E* t, size_t ts, size_t tplanes, F f){
+    constexpr size_t W = BATCH_LANES<E>;
+    using V = batch_lanes<E, W>;
+    size_t n = a.size(), sa = a.stride();
+    const E* pa = a.plane(0, 0);
+    #pragma omp parallel for
+    for(size_t b0 = 0; b0 < n; b0 += BATCH_CHUNK){
+        size_t b1 = std::min(n, b0 + BATCH_CHUNK);
+        for(size_t l0 = b0; l0 < b1; l0 += W){
+            size_t w = std::min(W, b1 - l0);
+            V x[d][d], y[d][d];
+            for(size_t ij = 0; ij < d * d; ++ij){
+                V& v = x[ij / d][ij % d];
+                if(w == W){
+                    std::copy_n(pa + ij * sa + l0, W, v.v);
+                }else{
+                    for(size_t l = 0; l < W; ++l)v.v[l] = l < w ? pa[ij * sa + l0 + l] : E(1);
+                }
+            }
+            f(x, y);
+            for(size_t ij = 0; ij < tplanes; ++ij)std::copy_n(y[ij / d][ij % d].v, w, t + ij * ts + l0);
+        }
+    }
+};
+
+// closed form (see mat_small.hpp), singular matrices come out non-finite, t must not alias a
+template <size_t d, typename E, template <typename T> typename _Alloc>
+void batched_mat_inverse(const batched_mat<d, d, E, _Alloc>& a, batched_mat<d, d, E, _Alloc>& t){
+    static_assert(mat_closed_form_v<d>, "batched inverse is closed form, up to 4x4");
+    assert(a.size() == t.size());
+    using V = batch_lanes<E, BATCH_LANES<E>>;
+    batched_mat_square_apply(a, t.plane(0, 0), t.stride(), d * d, [](const V (&x)[d][d], V (&y)[d][d]){
+        mat_inverse_det_small(x, y);
+    });
+};
+
+template <size_t d, typename E, template <typename T> typename _Alloc>
+void batched_mat_det(const batched_mat<d, d, E, _Alloc>& a, E* t){
+    static_assert(mat_closed_form_v<d>, "batched determinant is closed form, up to 4x4");
+    using V = batch_lanes<E, BATCH_LANES<E>>;
+    batched_mat_square_apply(a, t, 0, 1, [](const V (&x)[d][d], V (&y)[d][d]){
+        y[0][0] = mat_det_small(x);
+    });
+};
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef _SRC_LINEARALGEBRA_GEMM_H__
+#define _SRC_LINEARALGEBRA_GEMM_H__
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+#include "simd.hpp"
+
+// C += alpha * A * B on row-major strided storage.
+// Goto/BLIS layout: B is packed into KC x NR micro-panels (L1), A into MR x KC
+// micro-panels whose MC x KC block stays in L2, an MR x NR tile of C lives in registers.
+// A and B may be stored in a narrower type (fp16, int8, ...), packing widens them to E.
+template <typename E>
+struct gemm_engine{
+    constexpr static size_t MR = 6;
+    constexpr static size_t NR = (64 / sizeof(E) < 4) ? 4 : ((64 / sizeof(E) > 16) ? 16 : 64 / sizeof(E));
+    constexpr static size_t KC = 256;
+    constexpr static size_t MC = MR * 16;
+    constexpr static size_t NC = NR * 256;
+    // width of a 2D output tile handed to one thread, MC x NT
+    constexpr static size_t NT = NR * 16;
+
+    // below this amount of work packing and forking threads cost more than they save
+    static bool worth(size_t m, size_t n, size_t k){
+        return m * n * k >= 32 * 32 * 32;
+    };
+
+    static constexpr size_t round_up(size_t x, size_t r){
+        return (x + r - 1) / r * r;
+    };
+
+    // kc x nc block of B -> ceil(nc/NR) panels of kc x NR, zero padded
+    template <typename S>
+    static void pack_b(size_t kc, size_t nc, const S* b, size_t ldb, E* dst){
+        size_t panels = (nc + NR - 1) / NR;
+        #pragma omp parallel for
+        for(size_t jp = 0; jp < panels; ++jp){
+            size_t j0 = jp * NR, nr = std::min(NR, nc - j0);
+            E* d = dst + jp * NR * kc;
+            for(size_t p = 0; p < kc; ++p){
+                const S* s = b + p * ldb + j0;
+                size_t j = 0;
+                for(; j < nr; ++j)d[p * NR + j] = static_cast<E>(s[j]);
+                for(; j < NR; ++j)d[p * NR + j] = E(0);
+            }
+        }
+    };
+
+    // mc x kc block of A -> ceil(mc/MR) panels of MR x kc stored k-major, zero padded
+    template <typename S>
+    static void pack_a(size_t mc, size_t kc, const S* a, size_t lda, E* dst){
+        size_t panels = (mc + MR - 1) / MR;
+        #pragma omp parallel for
+        for(size_t ip = 0; ip < panels; ++ip){
+            size_t i0 = ip * MR, mr = std::min(MR, mc - i0);
+            E* d = dst + ip * MR * kc;
+            for(size_t i = 0; i < MR; ++i){
+                if(i < mr){
+                    const S* s = a + (i0 + i) * lda;
+                    for(size_t p = 0; p < kc; ++p)d[p * MR + i] = static_cast<E>(s[p]);
+                }else{
+                    for(size_t p = 0; p < kc; ++p)d[p * MR + i] = E(0);
+                }
+            }
+        }
+    };
+
+    // MR x NR register tile, only the top-left mr x nr part is written back
+    static void micro_kernel(size_t kc, const E* pa, const E* pb, E alpha, E* c, size_t ldc, size_t mr, size_t nr){
+        // flat accumulator + simd inner loop keeps the tile in vector registers
+        E acc[MR * NR] = {};
+        for(size_t p = 0; p < kc; ++p){
+            const E* ap = pa + p * MR;
+            const E* bp = pb + p * NR;
+            for(size_t i = 0; i < MR; ++i){
+                E ai = ap[i];
+                #pragma omp simd
+                for(size_t j = 0; j < NR; ++j)acc[i * NR + j] += ai * bp[j];
+            }
+        }
+        for(size_t i = 0; i < mr; ++i){
+            for(size_t j = 0; j < nr; ++j)c[i * ldc + j] += alpha * acc[i * NR + j];
+        }
+    };
+
+    // explicit simd tile for float/double picked by cpu, portable kernel otherwise
+    static simd_gemm_kernel_t<E> select_kernel(){
+        if constexpr (simd_gemm_supported_v<E>){
+            static_assert(MR == SIMD_GEMM_MR && NR == SIMD_GEMM_NR<E>, "packing must match the simd micro tile");
+            if(auto kernel = simd_gemm_kernel<E>())return kernel;
+        }
+        return &micro_kernel;
+    };
+
+    template <typename SA=E, typename SB=E>
+    static void run(size_t m, size_t n, size_t k, E alpha,
+                    const SA* a, size_t lda, const SB* b, size_t ldb, E* c, size_t ldc){
+        if(m == 0 || n == 0 || k == 0)return;
+        simd_gemm_kernel_t<E> kernel = select_kernel();
+        // packing buffers only grow, steady-state calls do not touch the heap
+        static thread_local std::vector<E> bpack, apack;
+        size_t bsize = std::min(KC, k) * round_up(std::min(NC, n), NR);
+        size_t asize = round_up(m, MR) * std::min(KC, k);
+        if(bpack.size() < bsize)bpack.resize(bsize);
+        if(apack.size() < asize)apack.resize(asize);
+        for(size_t jc = 0; jc < n; jc += NC){
+            size_t nc = std::min(NC, n - jc);
+            for(size_t pc = 0; pc < k; pc += KC){
+                size_t kc = std::min(KC, k - pc);
+                pack_b(kc, nc, b + pc * ldb + jc, ldb, bpack.data());
+                pack_a(m, kc, a + pc, lda, apack.data());
+                size_t mt = (m + MC - 1) / MC, nt = (nc + NT - 1) / NT;
+                // each thread owns whole MC x NT tiles of C, no write sharing
+                #pragma omp parallel for schedule(dynamic)
+                for(size_t t = 0; t < mt * nt; ++t){
+                    size_t ic = (t / nt) * MC, jt = (t % nt) * NT;
+                    size_t mc = std::min(MC, m - ic), ntw = std::min(NT, nc - jt);
+                    for(size_t jr = 0; jr < ntw; jr += NR){
+                        const E* pb = bpack.data() + (jt + jr) * kc;
+                        size_t nr = std::min(NR, ntw - jr);
+                        for(size_t ir = 0; ir < mc; ir += MR){
+                            const E* pa = apack.data() + (ic + ir) * kc;
+                            kernel(kc, pa, pb, alpha,
+                                   c + (ic + ir) * ldc + jc + jt + jr, ldc,
+                                   std::min(MR, mc - ir), nr);
+                        }
+                    }
+                }
+            }
+        }
+    };
+};
+
+// reference kernel for small problems and for checking the blocked path
+template <typename E, typename SA=E, typename SB=E>
+inline void gemm_naive(size_t m, size_t n, size_t k, E alpha,
+                       const SA* a, size_t lda, const SB* b, size_t ldb, E* c, size_t ldc){
+    for(size_t i = 0; i < m; ++i){
+        for(size_t p = 0; p < k; ++p){
+            E tmp = alpha * static_cast<E>(a[i * lda + p]);
+            for(size_t j = 0; j < n; ++j)c[i * ldc + j] += tmp * static_cast<E>(b[p * ldb + j]);
+        }
+    }
+};
+
+// E is the compute / accumulate type, SA and SB the storage types of A and B
+template <typename E, typename SA=E, typename SB=E>
+inline void gemm(size_t m, size_t n, size_t k, E alpha,
+                 const SA* a, size_t lda, const SB* b, size_t ldb, E* c, size_t ldc){
+    if(gemm_engine<E>::worth(m, n, k)){
+        gemm_engine<E>::run(m, n, k, alpha, a, lda, b, ldb, c, ldc);
+    }else{
+        gemm_naive<E, SA, SB>(m, n, k, alpha, a, lda, b, ldb, c, ldc);
+    }
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef _SRC_LINEARALGEBRA_MAPPED_MAT_H__
+#define _SRC_LINEARALGEBRA_MAPPED_MAT_H__
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "mat.hpp"
+#include "../mappedfile.hpp"
+
+// matrix living in a memory-mapped file, for data larger than RAM or kept across runs.
+// file = 64-byte header + row-major elements, opening maps it without copying.
+// tiled_gemm / tiled_add / tiled_convert walk operands tile by tile so that only
+// `budget` bytes of heap are used, they accept any mix of mat, heap_mat and mapped_mat.
+
+constexpr size_t MAPPED_MAT_HEADER = 64;
+// default heap budget of the tiled kernels
+constexpr size_t MAPPED_BUDGET = size_t(256) << 20;
+
+struct mapped_mat_header{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t elem_size;
+    std::uint64_t rows;
+    std::uint64_t cols;
+    char kind;      // 'f' floating, 'i' signed, 'u' unsigned, 'o' other
+};
+static_assert(sizeof(mapped_mat_header) <= MAPPED_MAT_HEADER, "header must fit its slot");
+
+template <size_t d1, size_t d2, typename E=DEFAULT_ELEMENT>
+class mapped_mat{
+    MappedFile file;
+
+    static mapped_mat_header header(){
+        mapped_mat_header h{};
+        std::memcpy(h.magic, "LINALGM", 8);
+        h.version = 1;
+        h.elem_size = sizeof(E);
+        h.rows = d1;
+        h.cols = d2;
+        h.kind = std::is_floating_point_v<E> ? 'f' : (std::is_integral_v<E> ? (std::is_signed_v<E> ? 'i' : 'u') : 'o');
+        return h;
+    };
+
+    explicit mapped_mat(MappedFile&& f):file(std::move(f)){};
+
+public:
+    constexpr static size_t bytes = MAPPED_MAT_HEADER + d1 * d2 * sizeof(E);
+
+    mapped_mat() = default;
+
+    // new file, contents zero
+    static mapped_mat create(const std::string& path){
+        mapped_mat ret(MappedFile(path, MappedFile::Mode::Create, bytes));
+        mapped_mat_header h = header();
+        std::memcpy(ret.file.data(), &h, sizeof(h));
+        return ret;
+    };
+
+    template <template <typename T> typename _Alloc>
+    static mapped_mat create(const std::string& path, const heap_mat<d1, d2, E, _Alloc>& src){
+        mapped_mat ret = create(path);
+        std::memcpy(ret.data(), &(src->e[0][0]), d1 * d2 * sizeof(E));
+        return ret;
+    };
+
+    // existing file, shape and element type must match
+    static mapped_mat open(const std::string& path, bool writable=false){
+        mapped_mat ret(MappedFile(path, writable ? MappedFile::Mode::Write : MappedFile::Mode::Read));
+        mapped_mat_header h = header(), got{};
+        if(ret.file.size() != bytes)throw std::runtime_error("mapped_mat: size mismatch '" + path + "'");
+        std::memcpy(&got, ret.file.data(), sizeof(got));
+        if(std::memcmp(&h, &got, sizeof(h)) != 0)throw std::runtime_error("mapped_mat: header mismatch '" + path + "'");
+        return ret;
+    };
+
+    bool writable()const{return file.isWritable();};
+
+    // writing through a mapping opened read-only faults
+    E* data(){return reinterpret_cast<E*>(static_cast<char*>(file.data()) + MAPPED_MAT_HEADER);};
+    const E* data()const{return reinterpret_cast<const E*>(static_cast<const char*>(file.data()) + MAPPED_MAT_HEADER);};
+
+    mat<d1, d2, E>* operator->(){return reinterpret_cast<mat<d1, d2, E>*>(data());};
+    const mat<d1, d2, E>* operator->()const{return reinterpret_cast<const mat<d1, d2, E>*>(data());};
+
+    // persist everything written so far
+    void flush(){file.flush();};
+
+    template <template <typename T> typename _Alloc=DEFAULT_ALLOCATOR>
+    heap_mat<d1, d2, E, _Alloc> to_heap()const{
+        heap_mat<d1, d2, E, _Alloc> ret;
+        std::memcpy(&(ret->e[0][0]), data(), d1 * d2 * sizeof(E));
+        return ret;
+    };
+};
+
+template <size_t d1, size_t d2, typename E>
+struct mat_shape<mapped_mat<d1, d2, E>>{
+    constexpr static size_t rows = d1;
+    constexpr static size_t cols = d2;
+    using value_type = E;
+};
+
+template <size_t d1, size_t d2, typename E>
+E* mat_data(mapped_mat<d1, d2, E>& m){return m.data();};
+
+template <size_t d1, size_t d2, typename E>
+const E* mat_data(const mapped_mat<d1, d2, E>& m){return m.data();};
+
+// c = a * b. square tiles of a, b and c are copied to heap buffers of `budget` bytes in total,
+// each c tile is accumulated over k with gemm and written once
+template <typename A, typename B, typename C>
+void tiled_gemm(const A& a, const B& b, C& c, size_t budget=MAPPED_BUDGET){
+    using E = typename mat_shape<A>::value_type;
+    static_assert(std::is_same_v<E, typename mat_shape<B>::value_type> && std::is_same_v<E, typename mat_shape<C>::value_type>,
+        "matrix element type mismatch");
+    constexpr size_t m = mat_shape<A>::rows, k = mat_shape<A>::cols, n = mat_shape<B>::cols;
+    static_assert(mat_shape<B>::rows == k && mat_shape<C>::rows == m && mat_shape<C>::cols == n, "matrix shape mismatch");
+    size_t t = 64;
+    while(3 * (2 * t) * (2 * t) * sizeof(E) <= budget)t *= 2;
+    size_t tm = std::min(t, m), tn = std::min(t, n), tk = std::min(t, k);
+    const E* pa = mat_data(a);
+    const E* pb = mat_data(b);
+    E* pc = mat_data(c);
+    std::vector<E> abuf(tm * tk), bbuf(tk * tn), cbuf(tm * tn);
+    for(size_t i0 = 0; i0 < m; i0 += tm){
+        size_t mi = std::min(tm, m - i0);
+        for(size_t j0 = 0; j0 < n; j0 += tn){
+            size_t nj = std::min(tn, n - j0);
+            std::fill(cbuf.begin(), cbuf.end(), E(0));
+            for(size_t p0 = 0; p0 < k; p0 += tk){
+                size_t kp = std::min(tk, k - p0);
+                #pragma omp parallel for
+                for(size_t i = 0; i < mi; ++i)std::copy_n(pa + (i0 + i) * k + p0, kp, abuf.data() + i * kp);
+                #pragma omp parallel for
+                for(size_t p = 0; p < kp; ++p)std::copy_n(pb + (p0 + p) * n + j0, nj, bbuf.data() + p * nj);
+                gemm<E>(mi, nj, kp, E(1), abuf.data(), kp, bbuf.data(), nj, cbuf.data(), nj);
+            }
+            #pragma omp parallel for
+            for(size_t i = 0; i < mi; ++i)std::copy_n(cbuf.data() + i * nj, nj, pc + (i0 + i) * n + j0);
+        }
+    }
+};
+
+// elements per streaming step, a third of the budget per operand
+template <typename E>
+size_t tiled_chunk(size_t budget){
+    return std::max<size_t>(MAT_SIMD_CHUNK, budget / (3 * sizeof(E)));
+};
+
+// c = a + b (sub: a - b), streamed in chunks straight through the mappings
+template <typename A, typename B, typename C>
+void tiled_add(const A& a, const B& b, C& c, size_t budget=MAPPED_BUDGET, bool sub=false){
+    using E = typename mat_shape<A>::value_type;
+    static_assert(std::is_same_v<E, typename mat_shape<B>::value_type> && std::is_same_v<E, typename mat_shape<C>::value_type>,
+        "matrix element type mismatch");
+    constexpr size_t n = mat_shape<A>::rows * mat_shape<A>::cols;
+    static_assert(mat_shape<B>::rows * mat_shape<B>::cols == n && mat_shape<C>::rows * mat_shape<C>::cols == n, "matrix shape mismatch");
+    const E* pa = mat_data(a);
+    const E* pb = mat_data(b);
+    E* pc = mat_data(c);
+    size_t chunk = tiled_chunk<E>(budget);
+    for(size_t j0 = 0; j0 < n; j0 += chunk){
+        size_t j1 = std::min(n, j0 + chunk);
+        #pragma omp parallel for
+        for(size_t j = j0; j < j1; j += MAT_SIMD_CHUNK){
+            simd_addsub<E>(pa + j, pb + j, pc + j, std::min(MAT_SIMD_CHUNK, j1 - j), sub);
+        }
+    }
+};
+
+template <typename A, typename B, typename C>
+void tiled_sub(const A& a, const B& b, C& c, size_t budget=MAPPED_BUDGET){
+    tiled_add(a, b, c, budget, true);
+};
+
+// dst = static_cast<To>(src), streamed in chunks
+template <typename S, typename D>
+void tiled_convert(const S& src, D& dst, size_t budget=MAPPED_BUDGET){
+    using From = typename mat_shape<S>::value_type;
+    using To = typename mat_shape<D>::value_type;
+    constexpr size_t n = mat_shape<S>::rows * mat_shape<S>::cols;
+    static_assert(mat_shape<D>::rows * mat_shape<D>::cols == n, "matrix shape mismatch");
+    const From* s = mat_data(src);
+    To* d = mat_data(dst);
+    size_t chunk = std::max<size_t>(MAT_SIMD_CHUNK, budget / (sizeof(From) + sizeof(To)));
+    for(size_t j = 0; j < n; j += chunk)mat_convert<From, To>(s + j, d + j, std::min(chunk, n - j));
+};
+
+// converted copy of src in a new file
+template <typename NewE, size_t d1, size_t d2, typename E>
+mapped_mat<d1, d2, NewE> astype(const mapped_mat<d1, d2, E>& src, const std::string& path, size_t budget=MAPPED_BUDGET){
+    mapped_mat<d1, d2, NewE> ret = mapped_mat<d1, d2, NewE>::create(path);
+    tiled_convert(src, ret, budget);
+    return ret;
+};
+
+#endif
@@ -7,6 +7,11 @@
 #include <array>
 #include <initializer_list>
 #include <cmath>
+#include <cstring>
+
+#include "gemm.hpp"
+#include "allocator.hpp"
+#include "mat_small.hpp"
 
 using DEFAULT_ELEMENT = float;
 template <typename _Ty>
@@ -31,8 +36,9 @@ inline bool equal<double>(const double& a, const double& b){
     return fabs(a-b)<=1e-12;
 }
 
-template<size_t d1, size_t d2, size_t d3, typename E>
-inline void mat_mul(const E e1[d1][d2], const E e2[d2][d3], E t[d1][d3]){
+// row-parallel i-j-k kernel, kept for mixed element types and as reference for mat_mul
+template<size_t d1, size_t d2, size_t d3, typename E, typename E2=E, typename R=E>
+inline void mat_mul_naive(const E e1[d1][d2], const E2 e2[d2][d3], R t[d1][d3]){
     #pragma omp parallel for
     for(size_t i = 0; i < d1; ++i){
         for(size_t j = 0; j < d2; ++j){
@@ -44,19 +50,52 @@ inline void mat_mul(const E e1[d1][d2], const E e2[d2][d3], E t[d1][d3]){
     }
 };
 
+// t += e1 * e2, packed and cache blocked, see gemm.hpp
+template<size_t d1, size_t d2, size_t d3, typename E>
+inline void mat_mul(const E e1[d1][d2], const E e2[d2][d3], E t[d1][d3]){
+    gemm<E>(d1, d3, d2, static_cast<E>(1), &(e1[0][0]), d2, &(e2[0][0]), d3, &(t[0][0]), d3);
+};
+
+// elements handed to one simd kernel call inside the parallel loops
+constexpr size_t MAT_SIMD_CHUNK = 4096;
+
 template<size_t d1, size_t d2, typename E>
 inline void mat_add(const E e1[d1][d2], const E e2[d1][d2], E t[d1][d2]){
     #pragma omp parallel for
-    for(size_t j = 0; j < d1*d2; ++j){
-        t[0][j] = e1[0][j] + e2[0][j];
+    for(size_t j = 0; j < d1*d2; j += MAT_SIMD_CHUNK){
+        simd_add<E>(&(e1[0][0]) + j, &(e2[0][0]) + j, &(t[0][0]) + j, std::min(MAT_SIMD_CHUNK, d1*d2 - j));
     }
 };
 
 template<size_t d1, size_t d2, typename E>
 inline void mat_sub(const E e1[d1][d2], const E e2[d1][d2], E t[d1][d2]){
     #pragma omp parallel for
-    for(size_t j = 0; j < d1*d2; ++j){
-        t[0][j] = e1[0][j] - e2[0][j];
+    for(size_t j = 0; j < d1*d2; j += MAT_SIMD_CHUNK){
+        simd_sub<E>(&(e1[0][0]) + j, &(e2[0][0]) + j, &(t[0][0]) + j, std::min(MAT_SIMD_CHUNK, d1*d2 - j));
+    }
+};
+
+// d[i] = static_cast<To>(s[i]), s and d must not overlap
+template<typename From, typename To>
+inline void mat_convert(const From* s, To* d, size_t n){
+    #pragma omp parallel for
+    for(size_t j = 0; j < n; j += MAT_SIMD_CHUNK){
+        simd_convert<From, To>(s + j, d + j, std::min(MAT_SIMD_CHUNK, n - j));
+    }
+};
+
+// same-size conversion inside one buffer: every chunk is converted into a local buffer
+// and copied back, so no kernel reads From and writes To through the same addresses
+template<typename From, typename To>
+inline void mat_convert_inplace(void* p, size_t n){
+    static_assert(sizeof(From) == sizeof(To), "in-place conversion needs equal element sizes");
+    char* base = static_cast<char*>(p);
+    #pragma omp parallel for
+    for(size_t j = 0; j < n; j += MAT_SIMD_CHUNK){
+        size_t len = std::min(MAT_SIMD_CHUNK, n - j);
+        To dst[MAT_SIMD_CHUNK];
+        simd_convert<From, To>(reinterpret_cast<const From*>(base + j * sizeof(From)), dst, len);
+        std::memcpy(base + j * sizeof(To), dst, len * sizeof(To));
     }
 };
 
@@ -71,25 +110,52 @@ inline std::ostream& print_mat(const E m[d1][d2], std::ostream& os){
     return os;
 };
 
+// see solve.hpp
+template <typename M>
+class lu_factor;
+template <typename M>
+class cholesky_factor;
+
 template <size_t d1, size_t d2, typename E=DEFAULT_ELEMENT, std::enable_if_t<!std::is_pointer_v<E>, int> = 0>
 class mat{
 public:
     E e[d1][d2];
+    // small shapes go through the unrolled constexpr kernels of mat_small.hpp
     template <size_t side, typename OtherE>
-    decltype(auto) operator*(const mat<d2, side, OtherE>& other)const{
-        mat<d1, side, decltype(e[0][0]*other.e[0][0])> res={};
-        mat_mul<d1, d2, side, E, OtherE, decltype(e[0][0]*other.e[0][0])>(e, other.e, res.e);
+    constexpr decltype(auto) operator*(const mat<d2, side, OtherE>& other)const{
+        using R = decltype(e[0][0]*other.e[0][0]);
+        if constexpr (mat_small_v<d1, d2, side>){
+            mat<d1, side, R> res;
+            mat_mul_small(e, other.e, res.e);
+            return res;
+        }
+        mat<d1, side, R> res={};
+        if constexpr (std::is_same_v<E, OtherE> && std::is_same_v<E, R>){
+            mat_mul<d1, d2, side, E>(e, other.e, res.e);
+        }else{
+            mat_mul_naive<d1, d2, side, E, OtherE, R>(e, other.e, res.e);
+        }
         return res;
     };
     friend std::ostream& operator<<(std::ostream& os, const mat<d1, d2, E>& m){
         return print_mat<d1, d2, E>(m.e, os);
     };
-    mat operator+(const mat& other)const{
+    constexpr mat operator+(const mat& other)const{
+        if constexpr (mat_small_v<d1, d2>){
+            mat res;
+            mat_add_small(e, other.e, res.e);
+            return res;
+        }
         mat res={};
         mat_add<d1, d2, E>(other.e, e, res.e);
         return res;
     };
-    mat operator-(const mat& other)const{
+    constexpr mat operator-(const mat& other)const{
+        if constexpr (mat_small_v<d1, d2>){
+            mat res;
+            mat_sub_small(e, other.e, res.e);
+            return res;
+        }
         mat res={};
         mat_sub<d1, d2, E>(e, other.e, res.e);
         return res;
@@ -107,8 +173,32 @@ public:
     bool operator!=(const mat& other)const{
         return !(*this == other);
     }
+    lu_factor<mat> lu()const{return lu_factor<mat>(*this);};
+    cholesky_factor<mat> cholesky()const{return cholesky_factor<mat>(*this);};
+    // closed form up to 4x4, LU above
+    constexpr E det()const{
+        if constexpr (d1 == d2 && mat_closed_form_v<d1>){
+            return mat_det_small(e);
+        }else{
+            return lu_factor<mat>(*this).det();
+        }
+    };
+    constexpr mat inverse()const{
+        if constexpr (d1 == d2 && mat_closed_form_v<d1>){
+            mat res;
+            mat_inverse_small(e, res.e);
+            return res;
+        }else{
+            return lu_factor<mat>(*this).inverse();
+        }
+    };
+    // this^-1 * b, through the factorization, the inverse is never formed
+    template <typename B>
+    B solve_mul(const B& b)const{return lu_factor<mat>(*this).solve(b);};
 };
 
+#include "mat_expr.hpp"
+
 template <size_t d1, size_t d2, typename E=DEFAULT_ELEMENT, template <typename T> typename _Alloc=DEFAULT_ALLOCATOR>
 class heap_mat{
 public:
@@ -152,6 +242,40 @@ public:
         //std::cout << e->e << "::move(" << other->e << ")" << std::endl;
         other.e = nullptr;
     }
+
+    // evaluate a lazy expression (see mat_expr.hpp) with a single allocation
+    template <typename Ex, std::enable_if_t<is_mat_expr_v<Ex>, int> = 0>
+    heap_mat(const Ex& ex):heap_mat(){
+        static_assert(Ex::rows == d1 && Ex::cols == d2 && std::is_same_v<typename Ex::value_type, E>,
+            "expression shape or element type mismatch");
+        mat_eval(ex, &(e->e[0][0]));
+    };
+
+    heap_mat& operator=(const heap_mat& other){
+        if(this != &other){
+            std::copy(&(other.e->e[0][0]), &(other.e->e[d1][0]), &(e->e[0][0]));
+        }
+        return *this;
+    };
+
+    heap_mat& operator=(heap_mat&& other){
+        std::swap(e, other.e);
+        return *this;
+    };
+
+    // in place when possible, a product reading *this is evaluated aside and swapped in
+    template <typename Ex, std::enable_if_t<is_mat_expr_v<Ex>, int> = 0>
+    heap_mat& operator=(const Ex& ex){
+        static_assert(Ex::rows == d1 && Ex::cols == d2 && std::is_same_v<typename Ex::value_type, E>,
+            "expression shape or element type mismatch");
+        if(ex.product_touches(&(e->e[0][0]))){
+            heap_mat tmp(ex);
+            std::swap(e, tmp.e);
+        }else{
+            mat_eval(ex, &(e->e[0][0]));
+        }
+        return *this;
+    };
     
     // template <typename OldE, std::enable_if_t<!std::is_same_v<OldE, E>, int> = 0>
     // heap_mat(heap_mat<d1, d2, OldE, _Alloc>&& other):allocator(),e(reinterpret_cast<mat<d1, d2, NewE>*>(dst.e)){
@@ -177,67 +301,11 @@ public:
         }
     }
     
-    template <size_t side>
-    heap_mat<d1, side, E, _Alloc> operator*(const heap_mat<d2, side, E, _Alloc>& other)const{
-        heap_mat<d1, side, E, _Alloc> res{static_cast<E>(0)};
-        mat_mul<d1, d2, side, E>(e->e, other.e->e, res.e->e);
-        return std::move(res);
-    };
-
-    // TODO: small n*n matrix optimize, reduce 1 allocate, add 1 copy
-    // template <std::enable_if_t<(d1==d2) && (d1*d1*sizeof(E)<64U), int> = 0>
-    // friend decltype(auto) operator*(heap_mat&& fst, const heap_mat& sec){
-    //     static heap_mat res;
-    //     res.set(static_cast<E>(0));
-    //     mat_mul<d1, d2, side, E>(fst.e->e, sec.e->e, res.e->e);
-    //     std::uninitialized_copy(&(res.e->e[0][0]), &(res.e->e[d1][0]), &(fst->e[0][0]));
-    //     return std::move(fst);
-    // };
-    //
-    // template <std::enable_if_t<(d1==d2) && (d1*d1*sizeof(E)<64U), int> = 0>
-    // friend decltype(auto) operator*(const heap_mat& fst, heap_mat&& sec){
-    //     static heap_mat res;
-    //     res.set(static_cast<E>(0));
-    //     mat_mul<d1, d2, side, E>(fst.e->e, sec.e->e, res.e->e);
-    //     std::uninitialized_copy(&(res.e->e[0][0]), &(res.e->e[d1][0]), &(sec->e[0][0]));
-    //     return std::move(sec);
-    // };
-
     friend std::ostream& operator<<(std::ostream& os, const heap_mat<d1, d2, E, _Alloc>& m){
         return print_mat<d1, d2, E>(m.e->e, os);
     };
 
-    heap_mat operator+(const heap_mat& other)const{
-        heap_mat res{static_cast<E>(0)};
-        mat_add<d1, d2, E>(e->e, other.e->e, res.e->e);
-        return std::move(res);
-    };
-
-    heap_mat operator+(heap_mat&& other)const{
-        mat_add<d1, d2, E>(e->e, other.e->e, other.e->e);
-        return std::move(other);
-    };
-
-    friend heap_mat operator+(heap_mat&& other, const heap_mat& s){
-        mat_add<d1, d2, E>(s.e->e, other.e->e, other.e->e);
-        return std::move(other);
-    };
-
-    heap_mat operator-(const heap_mat& other)const{
-        heap_mat res{static_cast<E>(0)};
-        mat_sub<d1, d2, E>(e->e, other.e->e, res.e->e);
-        return std::move(res);
-    };
-
-    heap_mat operator-(heap_mat&& other)const{
-        mat_add<d1, d2, E>(e->e, other.e->e, other.e->e);
-        return std::move(other);
-    };
-
-    friend heap_mat operator-(heap_mat&& other, const heap_mat& s){
-        mat_add<d1, d2, E>(other.e->e, s.e->e, other.e->e);
-        return std::move(other);
-    };
+    // + - * are lazy, see mat_expr.hpp
 
     bool operator==(const heap_mat& other)const{
         return (*e)==(*(other.e));
@@ -252,6 +320,13 @@ public:
         return std::move(ret);
     };
 
+    lu_factor<heap_mat> lu()const{return lu_factor<heap_mat>(*this);};
+    cholesky_factor<heap_mat> cholesky()const{return cholesky_factor<heap_mat>(*this);};
+    heap_mat inverse()const{return lu_factor<heap_mat>(*this).inverse();};
+    // this^-1 * b, through the factorization, the inverse is never formed
+    template <typename B>
+    B solve_mul(const B& b)const{return lu_factor<heap_mat>(*this).solve(b);};
+
     template <typename NewE, size_t od1, size_t od2, typename _E,
                 template <typename _Ty> typename __Alloc, 
                 std::enable_if_t<sizeof(NewE)==sizeof(_E) && !(std::is_same_v<NewE, _E>), int>>
@@ -286,11 +361,9 @@ public:
 template <typename NewE, size_t od1, size_t od2, typename _E, template <typename _Ty> typename __Alloc, std::enable_if_t<sizeof(NewE)==sizeof(_E) && !(std::is_same_v<NewE, _E>), int> = 0>
 heap_mat<od1, od2, NewE, __Alloc> astype(heap_mat<od1, od2, _E, __Alloc>&& dst){
     // std::cout << "NewE astype(E&&)" << std::endl;
+    mat_convert_inplace<_E, NewE>(dst.e, od1*od2);
     heap_mat<od1, od2, NewE, __Alloc> ret(reinterpret_cast<mat<od1, od2, NewE>*>(dst.e));
     dst.e = nullptr;
-    _E* src = reinterpret_cast<_E*>(&(ret->e[0][0]));
-    #pragma omp parallel for
-    for(size_t i=0;i<od1*od2;++i)ret->e[0][i]=static_cast<NewE>(src[i]);
     return std::move(ret);
 };
 
@@ -304,8 +377,7 @@ template <typename NewE, size_t od1, size_t od2, typename _E, template <typename
 heap_mat<od1, od2, NewE, __Alloc> astype(const heap_mat<od1, od2, _E, __Alloc>& dst){
     // std::cout << "NewE astype(const E&)" << std::endl;
     heap_mat<od1, od2, NewE, __Alloc> cpy;
-    #pragma omp parallel for
-    for(size_t i=0;i<od1*od2;++i)cpy->e[0][i]=static_cast<NewE>(dst->e[0][i]);
+    mat_convert<_E, NewE>(&(dst->e[0][0]), &(cpy->e[0][0]), od1*od2);
     return std::move(cpy);
 };
 
@@ -327,7 +399,7 @@ heap_mat<nd1, nd2, _E, __Alloc> reintrepret(heap_mat<od1, od2, _E, __Alloc>&& ds
 template <size_t nd1, size_t nd2, size_t od1, size_t od2, typename _E, template <typename _Ty> typename __Alloc, std::enable_if_t<(nd1 * nd2)==(od1 * od2), int> = 0>
 heap_mat<nd1, nd2, _E, __Alloc> reintrepret(const heap_mat<od1, od2, _E, __Alloc>& dst){
     heap_mat dst1(dst);
-    using NewSizeMat_p = typename mat<nd1, nd2, _E>*;
+    using NewSizeMat_p = mat<nd1, nd2, _E>*;
     heap_mat<nd1, nd2, _E, __Alloc> ret(reinterpret_cast<NewSizeMat_p>(dst1.e));
     dst1.e = nullptr;
     return std::move(ret);
@@ -358,4 +430,13 @@ heap_mat<d1, d2, E, _Alloc> zeros(){
     return heap_mat<d1, d2, E, _Alloc>{static_cast<E>(0)};
 };
 
+// heap_mat backed by the allocators in allocator.hpp
+template <size_t d1, size_t d2, typename E=DEFAULT_ELEMENT>
+using pool_mat = heap_mat<d1, d2, E, pool_allocator>;
+
+template <size_t d1, size_t d2, typename E=DEFAULT_ELEMENT>
+using arena_mat = heap_mat<d1, d2, E, arena_allocator>;
+
+#include "solve.hpp"
+
 #endif
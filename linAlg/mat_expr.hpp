@@ -0,0 +1,265 @@
+#ifndef _SRC_LINEARALGEBRA_MAT_EXPR_H__
+#define _SRC_LINEARALGEBRA_MAT_EXPR_H__
+
+#include <type_traits>
+#include <utility>
+#include <algorithm>
+#include <iostream>
+
+#include "gemm.hpp"
+
+// lazy heap_mat arithmetic.
+// + - unary- and scalar* build a tree that is evaluated once, on assignment or eval():
+// every element-wise term is fused into one pass over the destination, then each
+// product term is accumulated into it by gemm, so A*B + C - D costs one sweep + one gemm
+// and no temporaries.
+
+template <size_t d1, size_t d2, typename E, template <typename T> typename _Alloc>
+class heap_mat;
+
+template <typename Derived>
+struct mat_expr{
+    const Derived& self()const{return static_cast<const Derived&>(*this);};
+};
+
+template <typename T>
+constexpr bool is_mat_expr_v = std::is_base_of_v<mat_expr<std::decay_t<T>>, std::decay_t<T>>;
+
+template <typename T>
+struct is_heap_mat : std::false_type{};
+
+template <size_t d1, size_t d2, typename E, template <typename T> typename _Alloc>
+struct is_heap_mat<heap_mat<d1, d2, E, _Alloc>> : std::true_type{};
+
+template <typename T>
+constexpr bool is_heap_mat_v = is_heap_mat<std::decay_t<T>>::value;
+
+template <typename T>
+constexpr bool is_mat_operand_v = is_heap_mat_v<T> || is_mat_expr_v<T>;
+
+// same allocator and element type, other shape
+template <typename M, size_t r, size_t c>
+struct heap_mat_rebind;
+
+template <size_t d1, size_t d2, typename E, template <typename T> typename _Alloc, size_t r, size_t c>
+struct heap_mat_rebind<heap_mat<d1, d2, E, _Alloc>, r, c>{
+    using type = heap_mat<r, c, E, _Alloc>;
+};
+
+template <typename M>
+struct mat_shape;
+
+template <size_t d1, size_t d2, typename E, template <typename T> typename _Alloc>
+struct mat_shape<heap_mat<d1, d2, E, _Alloc>>{
+    constexpr static size_t rows = d1;
+    constexpr static size_t cols = d2;
+    using value_type = E;
+};
+
+// node interface, every node provides:
+//   rows, cols, value_type, result_type, has_product
+//   elem(i)                 element-wise part of flat element i
+//   add_products(alpha, t)  t += alpha * (every product term)
+//   touches(p)              some leaf reads storage p
+//   product_touches(p)      some product operand reads storage p
+template <typename M, typename Derived>
+struct mat_leaf_base : mat_expr<Derived>{
+    constexpr static size_t rows = mat_shape<M>::rows;
+    constexpr static size_t cols = mat_shape<M>::cols;
+    constexpr static bool has_product = false;
+    using value_type = typename mat_shape<M>::value_type;
+    using result_type = M;
+
+    const value_type* data()const{return &(static_cast<const Derived&>(*this).get()->e[0][0]);};
+    value_type elem(size_t i)const{return data()[i];};
+    void add_products(value_type, value_type*)const{};
+    bool touches(const value_type* p)const{return data() == p;};
+    bool product_touches(const value_type*)const{return false;};
+    result_type eval()const{return result_type(static_cast<const Derived&>(*this).get());};
+};
+
+// lvalue heap_mat operand, must outlive the expression
+template <typename M>
+struct mat_ref : mat_leaf_base<M, mat_ref<M>>{
+    const M* m;
+    explicit mat_ref(const M& src):m(&src){};
+    const M& get()const{return *m;};
+};
+
+// rvalue heap_mat operand, moved into the expression
+template <typename M>
+struct mat_val : mat_leaf_base<M, mat_val<M>>{
+    M m;
+    explicit mat_val(M&& src):m(std::move(src)){};
+    const M& get()const{return m;};
+};
+
+template <typename T>
+struct is_mat_leaf : std::false_type{};
+template <typename M>
+struct is_mat_leaf<mat_ref<M>> : std::true_type{};
+template <typename M>
+struct is_mat_leaf<mat_val<M>> : std::true_type{};
+
+template <typename T>
+using mat_node_t = std::conditional_t<is_heap_mat_v<T>,
+    std::conditional_t<std::is_lvalue_reference_v<T>, mat_ref<std::decay_t<T>>, mat_val<std::decay_t<T>>>,
+    std::decay_t<T>>;
+
+template <typename T>
+mat_node_t<T&&> mat_node(T&& t){
+    return mat_node_t<T&&>(std::forward<T>(t));
+};
+
+struct mat_op_add{
+    constexpr static int sign = 1;
+    template <typename E>
+    static E apply(const E& a, const E& b){return a + b;};
+};
+
+struct mat_op_sub{
+    constexpr static int sign = -1;
+    template <typename E>
+    static E apply(const E& a, const E& b){return a - b;};
+};
+
+template <typename L, typename R, typename Op>
+struct mat_binary : mat_expr<mat_binary<L, R, Op>>{
+    static_assert(L::rows == R::rows && L::cols == R::cols, "matrix shape mismatch");
+    static_assert(std::is_same_v<typename L::value_type, typename R::value_type>, "matrix element type mismatch");
+    constexpr static size_t rows = L::rows;
+    constexpr static size_t cols = L::cols;
+    constexpr static bool has_product = L::has_product || R::has_product;
+    using value_type = typename L::value_type;
+    using result_type = typename L::result_type;
+
+    L l;
+    R r;
+    mat_binary(L&& l, R&& r):l(std::move(l)), r(std::move(r)){};
+
+    value_type elem(size_t i)const{return Op::apply(l.elem(i), r.elem(i));};
+    void add_products(value_type alpha, value_type* t)const{
+        if constexpr (L::has_product)l.add_products(alpha, t);
+        if constexpr (R::has_product)r.add_products(Op::sign > 0 ? alpha : -alpha, t);
+    };
+    bool touches(const value_type* p)const{return l.touches(p) || r.touches(p);};
+    bool product_touches(const value_type* p)const{return l.product_touches(p) || r.product_touches(p);};
+    result_type eval()const{return result_type(*this);};
+};
+
+template <typename N>
+struct mat_scale : mat_expr<mat_scale<N>>{
+    constexpr static size_t rows = N::rows;
+    constexpr static size_t cols = N::cols;
+    constexpr static bool has_product = N::has_product;
+    using value_type = typename N::value_type;
+    using result_type = typename N::result_type;
+
+    N n;
+    value_type s;
+    mat_scale(N&& n, value_type s):n(std::move(n)), s(s){};
+
+    value_type elem(size_t i)const{return s * n.elem(i);};
+    void add_products(value_type alpha, value_type* t)const{
+        if constexpr (N::has_product)n.add_products(alpha * s, t);
+    };
+    bool touches(const value_type* p)const{return n.touches(p);};
+    bool product_touches(const value_type* p)const{return n.product_touches(p);};
+    result_type eval()const{return result_type(*this);};
+};
+
+// leaf operands are read in place, anything else is evaluated once into a temporary
+template <typename N>
+decltype(auto) mat_operand(const N& n){
+    if constexpr (is_mat_leaf<N>::value){
+        return n.data();
+    }else{
+        return n.eval();
+    }
+};
+
+template <typename E>
+const E* mat_operand_data(const E* p){return p;};
+
+template <typename M, std::enable_if_t<is_heap_mat_v<M>, int> = 0>
+const typename mat_shape<M>::value_type* mat_operand_data(const M& m){return &(m->e[0][0]);};
+
+template <typename L, typename R>
+struct mat_product : mat_expr<mat_product<L, R>>{
+    static_assert(L::cols == R::rows, "matrix shape mismatch");
+    static_assert(std::is_same_v<typename L::value_type, typename R::value_type>, "matrix element type mismatch");
+    constexpr static size_t rows = L::rows;
+    constexpr static size_t cols = R::cols;
+    constexpr static bool has_product = true;
+    using value_type = typename L::value_type;
+    using result_type = typename heap_mat_rebind<typename L::result_type, rows, cols>::type;
+
+    L l;
+    R r;
+    mat_product(L&& l, R&& r):l(std::move(l)), r(std::move(r)){};
+
+    value_type elem(size_t)const{return value_type(0);};
+    void add_products(value_type alpha, value_type* t)const{
+        decltype(auto) a = mat_operand(l);
+        decltype(auto) b = mat_operand(r);
+        gemm<value_type>(rows, cols, L::cols, alpha, mat_operand_data(a), L::cols, mat_operand_data(b), cols, t, cols);
+    };
+    bool touches(const value_type* p)const{return l.touches(p) || r.touches(p);};
+    bool product_touches(const value_type* p)const{return l.touches(p) || r.touches(p);};
+    result_type eval()const{return result_type(*this);};
+};
+
+// t = ex, t must not be read by a product operand
+template <typename Ex>
+void mat_eval(const Ex& ex, typename Ex::value_type* t){
+    using E = typename Ex::value_type;
+    constexpr size_t n = Ex::rows * Ex::cols;
+    constexpr size_t chunk = 4096;
+    #pragma omp parallel for
+    for(size_t j = 0; j < n; j += chunk){
+        size_t end = std::min(n, j + chunk);
+        for(size_t i = j; i < end; ++i)t[i] = ex.elem(i);
+    }
+    if constexpr (Ex::has_product)ex.add_products(E(1), t);
+};
+
+template <typename L, typename R>
+constexpr bool mat_operands_v = is_mat_operand_v<L> && is_mat_operand_v<R>;
+
+template <typename L, typename R, std::enable_if_t<mat_operands_v<L, R>, int> = 0>
+auto operator+(L&& l, R&& r){
+    return mat_binary<mat_node_t<L&&>, mat_node_t<R&&>, mat_op_add>(mat_node(std::forward<L>(l)), mat_node(std::forward<R>(r)));
+};
+
+template <typename L, typename R, std::enable_if_t<mat_operands_v<L, R>, int> = 0>
+auto operator-(L&& l, R&& r){
+    return mat_binary<mat_node_t<L&&>, mat_node_t<R&&>, mat_op_sub>(mat_node(std::forward<L>(l)), mat_node(std::forward<R>(r)));
+};
+
+template <typename L, typename R, std::enable_if_t<mat_operands_v<L, R>, int> = 0>
+auto operator*(L&& l, R&& r){
+    return mat_product<mat_node_t<L&&>, mat_node_t<R&&>>(mat_node(std::forward<L>(l)), mat_node(std::forward<R>(r)));
+};
+
+template <typename N, std::enable_if_t<is_mat_operand_v<N>, int> = 0>
+auto operator*(N&& n, typename mat_node_t<N&&>::value_type s){
+    return mat_scale<mat_node_t<N&&>>(mat_node(std::forward<N>(n)), s);
+};
+
+template <typename N, std::enable_if_t<is_mat_operand_v<N>, int> = 0>
+auto operator*(typename mat_node_t<N&&>::value_type s, N&& n){
+    return mat_scale<mat_node_t<N&&>>(mat_node(std::forward<N>(n)), s);
+};
+
+template <typename N, std::enable_if_t<is_mat_operand_v<N>, int> = 0>
+auto operator-(N&& n){
+    using E = typename mat_node_t<N&&>::value_type;
+    return mat_scale<mat_node_t<N&&>>(mat_node(std::forward<N>(n)), static_cast<E>(-1));
+};
+
+template <typename Ex, std::enable_if_t<is_mat_expr_v<Ex>, int> = 0>
+std::ostream& operator<<(std::ostream& os, const Ex& ex){
+    return os << ex.eval();
+};
+
+#endif
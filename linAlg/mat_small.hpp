@@ -0,0 +1,154 @@
+#ifndef _SRC_LINEARALGEBRA_MAT_SMALL_H__
+#define _SRC_LINEARALGEBRA_MAT_SMALL_H__
+
+#include <cstddef>
+#include <cassert>
+#include <utility>
+
+// kernels for stack mat whose dimensions are all <= MAT_SMALL_DIM.
+// everything is expanded by fold expressions at compile time: no loops, no branches,
+// no OpenMP region, every result element is written once, usable in constant expressions.
+
+constexpr size_t MAT_SMALL_DIM = 8;
+
+template <size_t... d>
+constexpr bool mat_small_v = ((d <= MAT_SMALL_DIM) && ...);
+
+// row a . column k of b
+template <size_t k, typename E, typename E2, size_t d2, size_t d3, size_t... j>
+constexpr auto mat_dot_small(const E (&a)[d2], const E2 (&b)[d2][d3], std::index_sequence<j...>){
+    return (... + (a[j] * b[j][k]));
+};
+
+template <size_t d1, size_t d2, size_t d3, typename E, typename E2, typename R, size_t... ik>
+constexpr void mat_mul_small(const E (&a)[d1][d2], const E2 (&b)[d2][d3], R (&t)[d1][d3], std::index_sequence<ik...>){
+    ((t[ik / d3][ik % d3] = mat_dot_small<ik % d3>(a[ik / d3], b, std::make_index_sequence<d2>{})), ...);
+};
+
+// t = a * b
+template <size_t d1, size_t d2, size_t d3, typename E, typename E2, typename R>
+constexpr void mat_mul_small(const E (&a)[d1][d2], const E2 (&b)[d2][d3], R (&t)[d1][d3]){
+    mat_mul_small(a, b, t, std::make_index_sequence<d1 * d3>{});
+};
+
+template <size_t d1, size_t d2, typename E, typename Op, size_t... ij>
+constexpr void mat_map_small(const E (&a)[d1][d2], const E (&b)[d1][d2], E (&t)[d1][d2], Op op, std::index_sequence<ij...>){
+    ((t[ij / d2][ij % d2] = op(a[ij / d2][ij % d2], b[ij / d2][ij % d2])), ...);
+};
+
+template <size_t d1, size_t d2, typename E>
+constexpr void mat_add_small(const E (&a)[d1][d2], const E (&b)[d1][d2], E (&t)[d1][d2]){
+    mat_map_small(a, b, t, [](const E& x, const E& y){return x + y;}, std::make_index_sequence<d1 * d2>{});
+};
+
+template <size_t d1, size_t d2, typename E>
+constexpr void mat_sub_small(const E (&a)[d1][d2], const E (&b)[d1][d2], E (&t)[d1][d2]){
+    mat_map_small(a, b, t, [](const E& x, const E& y){return x - y;}, std::make_index_sequence<d1 * d2>{});
+};
+
+// closed-form determinant / inverse up to 4x4
+template <size_t n>
+constexpr bool mat_closed_form_v = n >= 1 && n <= 4;
+
+template <typename E, size_t n>
+constexpr E mat_det_small(const E (&a)[n][n]){
+    static_assert(mat_closed_form_v<n>, "closed form only up to 4x4");
+    if constexpr (n == 1){
+        return a[0][0];
+    }else if constexpr (n == 2){
+        return a[0][0] * a[1][1] - a[0][1] * a[1][0];
+    }else if constexpr (n == 3){
+        return a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+             - a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+             + a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+    }else{
+        // Laplace expansion over the 2x2 minors of rows 0,1 and rows 2,3
+        E s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+        E s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+        E s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+        E s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+        E s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+        E s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+        E c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+        E c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+        E c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+        E c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+        E c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+        E c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+        return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+    }
+};
+
+// t = a^-1 through the adjugate and returns det(a), t is not finite when det(a) == 0
+template <typename E, size_t n>
+constexpr E mat_inverse_det_small(const E (&a)[n][n], E (&t)[n][n]){
+    static_assert(mat_closed_form_v<n>, "closed form only up to 4x4");
+    if constexpr (n == 1){
+        t[0][0] = E(1) / a[0][0];
+        return a[0][0];
+    }else if constexpr (n == 2){
+        E d = mat_det_small(a);
+        E r = E(1) / d;
+        t[0][0] = a[1][1] * r;  t[0][1] = -a[0][1] * r;
+        t[1][0] = -a[1][0] * r; t[1][1] = a[0][0] * r;
+        return d;
+    }else if constexpr (n == 3){
+        E c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+        E c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+        E c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+        E d = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+        E r = E(1) / d;
+        t[0][0] = c00 * r;
+        t[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * r;
+        t[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * r;
+        t[1][0] = c01 * r;
+        t[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * r;
+        t[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * r;
+        t[2][0] = c02 * r;
+        t[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * r;
+        t[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * r;
+        return d;
+    }else{
+        E s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+        E s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+        E s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+        E s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+        E s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+        E s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+        E c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+        E c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+        E c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+        E c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+        E c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+        E c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+        E d = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+        E r = E(1) / d;
+        t[0][0] = ( a[1][1] * c5 - a[1][2] * c4 + a[1][3] * c3) * r;
+        t[0][1] = (-a[0][1] * c5 + a[0][2] * c4 - a[0][3] * c3) * r;
+        t[0][2] = ( a[3][1] * s5 - a[3][2] * s4 + a[3][3] * s3) * r;
+        t[0][3] = (-a[2][1] * s5 + a[2][2] * s4 - a[2][3] * s3) * r;
+        t[1][0] = (-a[1][0] * c5 + a[1][2] * c2 - a[1][3] * c1) * r;
+        t[1][1] = ( a[0][0] * c5 - a[0][2] * c2 + a[0][3] * c1) * r;
+        t[1][2] = (-a[3][0] * s5 + a[3][2] * s2 - a[3][3] * s1) * r;
+        t[1][3] = ( a[2][0] * s5 - a[2][2] * s2 + a[2][3] * s1) * r;
+        t[2][0] = ( a[1][0] * c4 - a[1][1] * c2 + a[1][3] * c0) * r;
+        t[2][1] = (-a[0][0] * c4 + a[0][1] * c2 - a[0][3] * c0) * r;
+        t[2][2] = ( a[3][0] * s4 - a[3][1] * s2 + a[3][3] * s0) * r;
+        t[2][3] = (-a[2][0] * s4 + a[2][1] * s2 - a[2][3] * s0) * r;
+        t[3][0] = (-a[1][0] * c3 + a[1][1] * c1 - a[1][2] * c0) * r;
+        t[3][1] = ( a[0][0] * c3 - a[0][1] * c1 + a[0][2] * c0) * r;
+        t[3][2] = (-a[3][0] * s3 + a[3][1] * s1 - a[3][2] * s0) * r;
+        t[3][3] = ( a[2][0] * s3 - a[2][1] * s1 + a[2][2] * s0) * r;
+        return d;
+    }
+};
+
+// t = a^-1, a must be regular
+template <typename E, size_t n>
+constexpr void mat_inverse_small(const E (&a)[n][n], E (&t)[n][n]){
+    E d = mat_inverse_det_small(a, t);
+    assert(!(d == E(0)));
+    (void)d;
+};
+
+#endif
@@ -0,0 +1,246 @@
+#ifndef _SRC_LINEARALGEBRA_QUANT_H__
+#define _SRC_LINEARALGEBRA_QUANT_H__
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "mat.hpp"
+
+// reduced precision storage.
+// fp16 (ieee binary16) and bf16 (upper half of a float) are 2-byte element types for
+// heap_mat / mat, astype<fp16>(m) etc. go through the vectorized simd_convert
+// specializations below. q8_mat holds int8 values with a per-tensor or per-row float scale.
+// mat_mul_acc<Acc>(a, b) multiplies narrow storage with a wide accumulator:
+// fp16/bf16 x fp16/bf16 -> float, int8 x int8 -> int32.
+
+inline std::uint32_t quant_float_bits(float f){
+    std::uint32_t u;
+    std::memcpy(&u, &f, 4);
+    return u;
+};
+
+inline float quant_bits_float(std::uint32_t u){
+    float f;
+    std::memcpy(&f, &u, 4);
+    return f;
+};
+
+// round to nearest even, overflow -> inf, nan stays nan. branch free, vectorizes
+inline std::uint16_t quant_f32_to_f16(float x){
+    std::uint32_t f = quant_float_bits(x);
+    std::uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+    // denormal results: let the fpu round by adding 0.5 and reading the low mantissa bits
+    std::uint32_t denorm = quant_float_bits(quant_bits_float(f) + quant_bits_float(0x3f000000u)) - 0x3f000000u;
+    std::uint32_t normal = (f + 0xc8000fffu + ((f >> 13) & 1)) >> 13;
+    std::uint32_t o = f >= 0x47800000u ? (f > 0x7f800000u ? 0x7e00u : 0x7c00u) : (f < 0x38800000u ? denorm : normal);
+    return static_cast<std::uint16_t>(o | (sign >> 16));
+};
+
+inline float quant_f16_to_f32(std::uint16_t h){
+    std::uint32_t o = static_cast<std::uint32_t>(h & 0x7fffu) << 13;
+    std::uint32_t exp = o & 0x0f800000u;
+    o += 0x38000000u;
+    std::uint32_t special = o + 0x38000000u;
+    std::uint32_t denorm = quant_float_bits(quant_bits_float(o + 0x00800000u) - quant_bits_float(0x38800000u));
+    o = exp == 0x0f800000u ? special : (exp == 0 ? denorm : o);
+    return quant_bits_float(o | (static_cast<std::uint32_t>(h & 0x8000u) << 16));
+};
+
+inline std::uint16_t quant_f32_to_bf16(float x){
+    std::uint32_t u = quant_float_bits(x);
+    std::uint32_t rounded = (u + 0x7fffu + ((u >> 16) & 1)) >> 16;
+    return static_cast<std::uint16_t>((u & 0x7fffffffu) > 0x7f800000u ? ((u >> 16) | 0x40u) : rounded);
+};
+
+inline float quant_bf16_to_f32(std::uint16_t h){
+    return quant_bits_float(static_cast<std::uint32_t>(h) << 16);
+};
+
+struct fp16{
+    std::uint16_t bits;
+
+    fp16() = default;
+    explicit fp16(float f):bits(quant_f32_to_f16(f)){};
+    operator float()const{return quant_f16_to_f32(bits);};
+    static fp16 from_bits(std::uint16_t b){fp16 r; r.bits = b; return r;};
+};
+
+struct bf16{
+    std::uint16_t bits;
+
+    bf16() = default;
+    explicit bf16(float f):bits(quant_f32_to_bf16(f)){};
+    operator float()const{return quant_bf16_to_f32(bits);};
+    static bf16 from_bits(std::uint16_t b){bf16 r; r.bits = b; return r;};
+};
+
+inline std::ostream& operator<<(std::ostream& os, const fp16& x){return os << static_cast<float>(x);};
+inline std::ostream& operator<<(std::ostream& os, const bf16& x){return os << static_cast<float>(x);};
+
+// ---- bulk conversions, picked up by mat_convert / astype ----
+
+#if defined(LINALG_X86)
+LINALG_TARGET("avx512f")
+inline void quant_f32_to_f16_avx512(const float* s, fp16* d, size_t n){
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m256i h = _mm512_cvtps_ph(_mm512_loadu_ps(s + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), h);
+    }
+    for(; i < n; ++i)d[i].bits = quant_f32_to_f16(s[i]);
+};
+
+LINALG_TARGET("avx512f")
+inline void quant_f16_to_f32_avx512(const fp16* s, float* d, size_t n){
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16){
+        __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        _mm512_storeu_ps(d + i, _mm512_cvtph_ps(h));
+    }
+    for(; i < n; ++i)d[i] = quant_f16_to_f32(s[i].bits);
+};
+#endif
+
+template <>
+inline void simd_convert<float, fp16>(const float* s, fp16* d, size_t n){
+#if defined(LINALG_X86)
+    if(simd_active() >= simd_level::avx512)return quant_f32_to_f16_avx512(s, d, n);
+#endif
+    #pragma omp simd
+    for(size_t i = 0; i < n; ++i)d[i].bits = quant_f32_to_f16(s[i]);
+};
+
+template <>
+inline void simd_convert<fp16, float>(const fp16* s, float* d, size_t n){
+#if defined(LINALG_X86)
+    if(simd_active() >= simd_level::avx512)return quant_f16_to_f32_avx512(s, d, n);
+#endif
+    #pragma omp simd
+    for(size_t i = 0; i < n; ++i)d[i] = quant_f16_to_f32(s[i].bits);
+};
+
+template <>
+inline void simd_convert<float, bf16>(const float* s, bf16* d, size_t n){
+    #pragma omp simd
+    for(size_t i = 0; i < n; ++i)d[i].bits = quant_f32_to_bf16(s[i]);
+};
+
+template <>
+inline void simd_convert<bf16, float>(const bf16* s, float* d, size_t n){
+    #pragma omp simd
+    for(size_t i = 0; i < n; ++i)d[i] = quant_bf16_to_f32(s[i].bits);
+};
+
+// any other pair with a 2-byte float on one side goes through float in registers
+template <>
+inline void simd_convert<fp16, bf16>(const fp16* s, bf16* d, size_t n){
+    #pragma omp simd
+    for(size_t i = 0; i < n; ++i)d[i].bits = quant_f32_to_bf16(quant_f16_to_f32(s[i].bits));
+};
+
+template <>
+inline void simd_convert<bf16, fp16>(const bf16* s, fp16* d, size_t n){
+    #pragma omp simd
+    for(size_t i = 0; i < n; ++i)d[i].bits = quant_f32_to_f16(quant_bf16_to_f32(s[i].bits));
+};
+
+// ---- int8 with scales ----
+
+enum class quant_mode{
+    per_tensor,
+    per_row,
+};
+
+// symmetric: value = q * scale, q in [-127, 127]
+template <size_t d1, size_t d2, template <typename T> typename _Alloc=DEFAULT_ALLOCATOR>
+struct q8_mat{
+    heap_mat<d1, d2, std::int8_t, _Alloc> q;
+    std::vector<float> scale;   // 1 entry per_tensor, d1 entries per_row
+    quant_mode mode;
+
+    float row_scale(size_t i)const{return scale[mode == quant_mode::per_row ? i : 0];};
+
+    static q8_mat quantize(const heap_mat<d1, d2, float, _Alloc>& src, quant_mode mode=quant_mode::per_row){
+        q8_mat ret;
+        ret.mode = mode;
+        size_t groups = mode == quant_mode::per_row ? d1 : 1, len = d1 * d2 / groups;
+        ret.scale.resize(groups);
+        const float* s = &(src->e[0][0]);
+        std::int8_t* d = &(ret.q->e[0][0]);
+        #pragma omp parallel for
+        for(size_t g = 0; g < groups; ++g){
+            const float* x = s + g * len;
+            float amax = 0.f;
+            #pragma omp simd reduction(max:amax)
+            for(size_t i = 0; i < len; ++i)amax = std::max(amax, std::fabs(x[i]));
+            float sc = amax > 0.f ? amax / 127.f : 1.f, inv = 1.f / sc;
+            ret.scale[g] = sc;
+            std::int8_t* y = d + g * len;
+            #pragma omp simd
+            for(size_t i = 0; i < len; ++i){
+                float r = x[i] * inv;
+                y[i] = static_cast<std::int8_t>(static_cast<int>(r + (r >= 0.f ? 0.5f : -0.5f)));
+            }
+        }
+        return ret;
+    };
+
+    heap_mat<d1, d2, float, _Alloc> dequantize()const{
+        heap_mat<d1, d2, float, _Alloc> ret;
+        const std::int8_t* s = &(q->e[0][0]);
+        float* d = &(ret->e[0][0]);
+        #pragma omp parallel for
+        for(size_t i = 0; i < d1; ++i){
+            float sc = row_scale(i);
+            #pragma omp simd
+            for(size_t j = 0; j < d2; ++j)d[i * d2 + j] = sc * static_cast<float>(s[i * d2 + j]);
+        }
+        return ret;
+    };
+};
+
+// ---- mixed precision products ----
+
+// int8 x int8 -> int32, c += a * b, row-major strided
+inline void gemm_s8(size_t m, size_t n, size_t k, const std::int8_t* a, size_t lda,
+                    const std::int8_t* b, size_t ldb, std::int32_t* c, size_t ldc){
+    gemm<std::int32_t, std::int8_t, std::int8_t>(m, n, k, 1, a, lda, b, ldb, c, ldc);
+};
+
+// fp16 storage, float accumulation, c += alpha * a * b
+inline void gemm_f16(size_t m, size_t n, size_t k, float alpha, const fp16* a, size_t lda,
+                     const fp16* b, size_t ldb, float* c, size_t ldc){
+    gemm<float, fp16, fp16>(m, n, k, alpha, a, lda, b, ldb, c, ldc);
+};
+
+// a * b with elements widened to Acc while packing, e.g. mat_mul_acc<float>(half_a, half_b)
+template <typename Acc, size_t d1, size_t d2, size_t d3, typename E, template <typename T> typename _Alloc>
+heap_mat<d1, d3, Acc, _Alloc> mat_mul_acc(const heap_mat<d1, d2, E, _Alloc>& a, const heap_mat<d2, d3, E, _Alloc>& b){
+    heap_mat<d1, d3, Acc, _Alloc> ret{static_cast<Acc>(0)};
+    gemm<Acc, E, E>(d1, d3, d2, static_cast<Acc>(1), &(a->e[0][0]), d2, &(b->e[0][0]), d3, &(ret->e[0][0]), d3);
+    return ret;
+};
+
+// dequantized a * b through the int8 gemm. scales must factor out of the sum over k,
+// so b has to be quantized per tensor
+template <size_t d1, size_t d2, size_t d3, template <typename T> typename _Alloc>
+heap_mat<d1, d3, float, _Alloc> mat_mul_q8(const q8_mat<d1, d2, _Alloc>& a, const q8_mat<d2, d3, _Alloc>& b){
+    assert(b.mode == quant_mode::per_tensor);
+    heap_mat<d1, d3, std::int32_t, _Alloc> acc = mat_mul_acc<std::int32_t>(a.q, b.q);
+    heap_mat<d1, d3, float, _Alloc> ret;
+    const std::int32_t* s = &(acc->e[0][0]);
+    float* d = &(ret->e[0][0]);
+    #pragma omp parallel for
+    for(size_t i = 0; i < d1; ++i){
+        float sc = a.row_scale(i) * b.scale[0];
+        #pragma omp simd
+        for(size_t j = 0; j < d3; ++j)d[i * d3 + j] = sc * static_cast<float>(s[i * d3 + j]);
+    }
+    return ret;
+};
+
+#endif
@@ -0,0 +1,698 @@
+#ifndef _SRC_LINEARALGEBRA_SIMD_H__
+#define _SRC_LINEARALGEBRA_SIMD_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LINALG_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+// gcc/clang only emit an ISA inside functions marked for it, msvc always can
+#if defined(LINALG_X86) && (defined(__GNUC__) || defined(__clang__))
+#define LINALG_TARGET(isa) __attribute__((target(isa)))
+#else
+#define LINALG_TARGET(isa)
+#endif
+
+enum class simd_level : int{
+    scalar = 0,
+    sse2 = 1,
+    avx2 = 2,   // avx2 + fma
+    avx512 = 3, // avx512f
+};
+
+inline simd_level simd_detect(){
+#if defined(LINALG_X86)
+#if defined(_MSC_VER) && !defined(__clang__)
+    int r[4];
+    __cpuid(r, 0);
+    int max_leaf = r[0];
+    __cpuid(r, 1);
+    bool fma = r[2] & (1 << 12), osxsave = r[2] & (1 << 27), avx = r[2] & (1 << 28);
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool ymm = (xcr0 & 0x6) == 0x6, zmm = (xcr0 & 0xe6) == 0xe6;
+    bool avx2 = false, avx512f = false;
+    if(max_leaf >= 7){
+        __cpuidex(r, 7, 0);
+        avx2 = r[1] & (1 << 5);
+        avx512f = r[1] & (1 << 16);
+    }
+    if(avx512f && avx2 && fma && zmm)return simd_level::avx512;
+    if(avx2 && fma && avx && ymm)return simd_level::avx2;
+    return simd_level::sse2;
+#else
+    __builtin_cpu_init();
+    bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if(avx2 && __builtin_cpu_supports("avx512f"))return simd_level::avx512;
+    if(avx2)return simd_level::avx2;
+    return simd_level::sse2;
+#endif
+#else
+    return simd_level::scalar;
+#endif
+};
+
+inline simd_level& simd_current(){
+    static simd_level level = simd_detect();
+    return level;
+};
+
+// level picked at startup from cpuid
+inline simd_level simd_active(){
+    return simd_current();
+};
+
+// cap the dispatch level, e.g. simd_level::scalar to run the reference kernels.
+// not thread safe, call outside of parallel regions. returns the previous level
+inline simd_level simd_force(simd_level level){
+    simd_level old = simd_current();
+    simd_current() = std::min(level, simd_detect());
+    return old;
+};
+
+// ---- scalar reference kernels ----
+
+template <typename E>
+inline void simd_add_scalar(const E* a, const E* b, E* t, size_t n){
+    for(size_t i = 0; i < n; ++i)t[i] = a[i] + b[i];
+};
+
+template <typename E>
+inline void simd_sub_scalar(const E* a, const E* b, E* t, size_t n){
+    for(size_t i = 0; i < n; ++i)t[i] = a[i] - b[i];
+};
+
+template <typename From, typename To>
+inline void simd_convert_scalar(const From* s, To* d, size_t n){
+    for(size_t i = 0; i < n; ++i)d[i] = static_cast<To>(s[i]);
+};
+
+template <typename E>
+using simd_gemm_kernel_t = void (*)(size_t kc, const E* pa, const E* pb, E alpha, E* c, size_t ldc, size_t mr, size_t nr);
+
+// gemm micro tile shared by all isa, must match gemm_engine<E>::MR / NR
+constexpr size_t SIMD_GEMM_MR = 6;
+template <typename E>
+constexpr size_t SIMD_GEMM_NR = 64 / sizeof(E);
+
+// write back an mr x nr corner of a full tile kept in acc
+template <typename E>
+inline void simd_gemm_partial(const E* acc, E alpha, E* c, size_t ldc, size_t mr, size_t nr){
+    for(size_t i = 0; i < mr; ++i){
+        for(size_t j = 0; j < nr; ++j)c[i * ldc + j] += alpha * acc[i * SIMD_GEMM_NR<E> + j];
+    }
+};
+
+#if defined(LINALG_X86)
+
+// ---- sse2 ----
+
+LINALG_TARGET("sse2")
+inline void simd_addsub_sse2(const float* a, const float* b, float* t, size_t n, bool sub){
+    size_t i = 0;
+    if(sub){
+        for(; i + 4 <= n; i += 4)_mm_storeu_ps(t + i, _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        for(; i < n; ++i)t[i] = a[i] - b[i];
+    }else{
+        for(; i + 4 <= n; i += 4)_mm_storeu_ps(t + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        for(; i < n; ++i)t[i] = a[i] + b[i];
+    }
+};
+
+LINALG_TARGET("sse2")
+inline void simd_addsub_sse2(const double* a, const double* b, double* t, size_t n, bool sub){
+    size_t i = 0;
+    if(sub){
+        for(; i + 2 <= n; i += 2)_mm_storeu_pd(t + i, _mm_sub_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        for(; i < n; ++i)t[i] = a[i] - b[i];
+    }else{
+        for(; i + 2 <= n; i += 2)_mm_storeu_pd(t + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        for(; i < n; ++i)t[i] = a[i] + b[i];
+    }
+};
+
+LINALG_TARGET("sse2")
+inline void simd_convert_sse2(const float* s, double* d, size_t n){
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2)_mm_storeu_pd(d + i, _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(s + i)))));
+    for(; i < n; ++i)d[i] = static_cast<double>(s[i]);
+};
+
+LINALG_TARGET("sse2")
+inline void simd_convert_sse2(const double* s, float* d, size_t n){
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2)_mm_storel_epi64(reinterpret_cast<__m128i*>(d + i), _mm_castps_si128(_mm_cvtpd_ps(_mm_loadu_pd(s + i))));
+    for(; i < n; ++i)d[i] = static_cast<float>(s[i]);
+};
+
+LINALG_TARGET("sse2")
+inline void simd_convert_sse2(const std::int32_t* s, float* d, size_t n){
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)_mm_storeu_ps(d + i, _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i))));
+    for(; i < n; ++i)d[i] = static_cast<float>(s[i]);
+};
+
+LINALG_TARGET("sse2")
+inline void simd_convert_sse2(const float* s, std::int32_t* d, size_t n){
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)_mm_storeu_si128(reinterpret_cast<__m128i*>(d + i), _mm_cvttps_epi32(_mm_loadu_ps(s + i)));
+    for(; i < n; ++i)d[i] = static_cast<std::int32_t>(s[i]);
+};
+
+// 6x16 does not fit 16 xmm registers, run it as two 6x8 halves.
+// rows are unrolled by hand so the tile stays in registers at -O2 as well
+LINALG_TARGET("sse2")
+inline void simd_gemm_sse2(size_t kc, const float* pa, const float* pb, float alpha, float* c, size_t ldc, size_t mr, size_t nr){
+    alignas(64) float acc[SIMD_GEMM_MR * 16];
+    for(size_t h = 0; h < 16; h += 8){
+        __m128 r00 = _mm_setzero_ps(), r01 = _mm_setzero_ps();
+        __m128 r10 = _mm_setzero_ps(), r11 = _mm_setzero_ps();
+        __m128 r20 = _mm_setzero_ps(), r21 = _mm_setzero_ps();
+        __m128 r30 = _mm_setzero_ps(), r31 = _mm_setzero_ps();
+        __m128 r40 = _mm_setzero_ps(), r41 = _mm_setzero_ps();
+        __m128 r50 = _mm_setzero_ps(), r51 = _mm_setzero_ps();
+        for(size_t p = 0; p < kc; ++p){
+            const float* bp = pb + p * 16 + h;
+            __m128 b0 = _mm_loadu_ps(bp), b1 = _mm_loadu_ps(bp + 4), a;
+            a = _mm_set1_ps(pa[p * 6 + 0]);
+            r00 = _mm_add_ps(r00, _mm_mul_ps(a, b0)); r01 = _mm_add_ps(r01, _mm_mul_ps(a, b1));
+            a = _mm_set1_ps(pa[p * 6 + 1]);
+            r10 = _mm_add_ps(r10, _mm_mul_ps(a, b0)); r11 = _mm_add_ps(r11, _mm_mul_ps(a, b1));
+            a = _mm_set1_ps(pa[p * 6 + 2]);
+            r20 = _mm_add_ps(r20, _mm_mul_ps(a, b0)); r21 = _mm_add_ps(r21, _mm_mul_ps(a, b1));
+            a = _mm_set1_ps(pa[p * 6 + 3]);
+            r30 = _mm_add_ps(r30, _mm_mul_ps(a, b0)); r31 = _mm_add_ps(r31, _mm_mul_ps(a, b1));
+            a = _mm_set1_ps(pa[p * 6 + 4]);
+            r40 = _mm_add_ps(r40, _mm_mul_ps(a, b0)); r41 = _mm_add_ps(r41, _mm_mul_ps(a, b1));
+            a = _mm_set1_ps(pa[p * 6 + 5]);
+            r50 = _mm_add_ps(r50, _mm_mul_ps(a, b0)); r51 = _mm_add_ps(r51, _mm_mul_ps(a, b1));
+        }
+        _mm_store_ps(acc + h, r00); _mm_store_ps(acc + h + 4, r01);
+        _mm_store_ps(acc + 16 + h, r10); _mm_store_ps(acc + 16 + h + 4, r11);
+        _mm_store_ps(acc + 32 + h, r20); _mm_store_ps(acc + 32 + h + 4, r21);
+        _mm_store_ps(acc + 48 + h, r30); _mm_store_ps(acc + 48 + h + 4, r31);
+        _mm_store_ps(acc + 64 + h, r40); _mm_store_ps(acc + 64 + h + 4, r41);
+        _mm_store_ps(acc + 80 + h, r50); _mm_store_ps(acc + 80 + h + 4, r51);
+    }
+    simd_gemm_partial<float>(acc, alpha, c, ldc, mr, nr);
+};
+
+LINALG_TARGET("sse2")
+inline void simd_gemm_sse2(size_t kc, const double* pa, const double* pb, double alpha, double* c, size_t ldc, size_t mr, size_t nr){
+    alignas(64) double acc[SIMD_GEMM_MR * 8];
+    for(size_t h = 0; h < 8; h += 4){
+        __m128d r00 = _mm_setzero_pd(), r01 = _mm_setzero_pd();
+        __m128d r10 = _mm_setzero_pd(), r11 = _mm_setzero_pd();
+        __m128d r20 = _mm_setzero_pd(), r21 = _mm_setzero_pd();
+        __m128d r30 = _mm_setzero_pd(), r31 = _mm_setzero_pd();
+        __m128d r40 = _mm_setzero_pd(), r41 = _mm_setzero_pd();
+        __m128d r50 = _mm_setzero_pd(), r51 = _mm_setzero_pd();
+        for(size_t p = 0; p < kc; ++p){
+            const double* bp = pb + p * 8 + h;
+            __m128d b0 = _mm_loadu_pd(bp), b1 = _mm_loadu_pd(bp + 2), a;
+            a = _mm_set1_pd(pa[p * 6 + 0]);
+            r00 = _mm_add_pd(r00, _mm_mul_pd(a, b0)); r01 = _mm_add_pd(r01, _mm_mul_pd(a, b1));
+            a = _mm_set1_pd(pa[p * 6 + 1]);
+            r10 = _mm_add_pd(r10, _mm_mul_pd(a, b0)); r11 = _mm_add_pd(r11, _mm_mul_pd(a, b1));
+            a = _mm_set1_pd(pa[p * 6 + 2]);
+            r20 = _mm_add_pd(r20, _mm_mul_pd(a, b0)); r21 = _mm_add_pd(r21, _mm_mul_pd(a, b1));
+            a = _mm_set1_pd(pa[p * 6 + 3]);
+            r30 = _mm_add_pd(r30, _mm_mul_pd(a, b0)); r31 = _mm_add_pd(r31, _mm_mul_pd(a, b1));
+            a = _mm_set1_pd(pa[p * 6 + 4]);
+            r40 = _mm_add_pd(r40, _mm_mul_pd(a, b0)); r41 = _mm_add_pd(r41, _mm_mul_pd(a, b1));
+            a = _mm_set1_pd(pa[p * 6 + 5]);
+            r50 = _mm_add_pd(r50, _mm_mul_pd(a, b0)); r51 = _mm_add_pd(r51, _mm_mul_pd(a, b1));
+        }
+        _mm_store_pd(acc + h, r00); _mm_store_pd(acc + h + 2, r01);
+        _mm_store_pd(acc + 8 + h, r10); _mm_store_pd(acc + 8 + h + 2, r11);
+        _mm_store_pd(acc + 16 + h, r20); _mm_store_pd(acc + 16 + h + 2, r21);
+        _mm_store_pd(acc + 24 + h, r30); _mm_store_pd(acc + 24 + h + 2, r31);
+        _mm_store_pd(acc + 32 + h, r40); _mm_store_pd(acc + 32 + h + 2, r41);
+        _mm_store_pd(acc + 40 + h, r50); _mm_store_pd(acc + 40 + h + 2, r51);
+    }
+    simd_gemm_partial<double>(acc, alpha, c, ldc, mr, nr);
+};
+
+// ---- avx2 + fma ----
+
+LINALG_TARGET("avx2,fma")
+inline void simd_addsub_avx2(const float* a, const float* b, float* t, size_t n, bool sub){
+    size_t i = 0;
+    if(sub){
+        for(; i + 8 <= n; i += 8)_mm256_storeu_ps(t + i, _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        for(; i < n; ++i)t[i] = a[i] - b[i];
+    }else{
+        for(; i + 8 <= n; i += 8)_mm256_storeu_ps(t + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+        for(; i < n; ++i)t[i] = a[i] + b[i];
+    }
+};
+
+LINALG_TARGET("avx2,fma")
+inline void simd_addsub_avx2(const double* a, const double* b, double* t, size_t n, bool sub){
+    size_t i = 0;
+    if(sub){
+        for(; i + 4 <= n; i += 4)_mm256_storeu_pd(t + i, _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        for(; i < n; ++i)t[i] = a[i] - b[i];
+    }else{
+        for(; i + 4 <= n; i += 4)_mm256_storeu_pd(t + i, _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        for(; i < n; ++i)t[i] = a[i] + b[i];
+    }
+};
+
+LINALG_TARGET("avx2,fma")
+inline void simd_convert_avx2(const float* s, double* d, size_t n){
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)_mm256_storeu_pd(d + i, _mm256_cvtps_pd(_mm_loadu_ps(s + i)));
+    for(; i < n; ++i)d[i] = static_cast<double>(s[i]);
+};
+
+LINALG_TARGET("avx2,fma")
+inline void simd_convert_avx2(const double* s, float* d, size_t n){
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4)_mm_storeu_ps(d + i, _mm256_cvtpd_ps(_mm256_loadu_pd(s + i)));
+    for(; i < n; ++i)d[i] = static_cast<float>(s[i]);
+};
+
+LINALG_TARGET("avx2,fma")
+inline void simd_convert_avx2(const std::int32_t* s, float* d, size_t n){
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)_mm256_storeu_ps(d + i, _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i))));
+    for(; i < n; ++i)d[i] = static_cast<float>(s[i]);
+};
+
+LINALG_TARGET("avx2,fma")
+inline void simd_convert_avx2(const float* s, std::int32_t* d, size_t n){
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + i), _mm256_cvttps_epi32(_mm256_loadu_ps(s + i)));
+    for(; i < n; ++i)d[i] = static_cast<std::int32_t>(s[i]);
+};
+
+LINALG_TARGET("avx2,fma")
+inline void simd_gemm_avx2(size_t kc, const float* pa, const float* pb, float alpha, float* c, size_t ldc, size_t mr, size_t nr){
+    __m256 r00 = _mm256_setzero_ps(), r01 = _mm256_setzero_ps();
+    __m256 r10 = _mm256_setzero_ps(), r11 = _mm256_setzero_ps();
+    __m256 r20 = _mm256_setzero_ps(), r21 = _mm256_setzero_ps();
+    __m256 r30 = _mm256_setzero_ps(), r31 = _mm256_setzero_ps();
+    __m256 r40 = _mm256_setzero_ps(), r41 = _mm256_setzero_ps();
+    __m256 r50 = _mm256_setzero_ps(), r51 = _mm256_setzero_ps();
+    for(size_t p = 0; p < kc; ++p){
+        const float* bp = pb + p * 16;
+        __m256 b0 = _mm256_loadu_ps(bp), b1 = _mm256_loadu_ps(bp + 8), a;
+        a = _mm256_set1_ps(pa[p * 6 + 0]);
+        r00 = _mm256_fmadd_ps(a, b0, r00); r01 = _mm256_fmadd_ps(a, b1, r01);
+        a = _mm256_set1_ps(pa[p * 6 + 1]);
+        r10 = _mm256_fmadd_ps(a, b0, r10); r11 = _mm256_fmadd_ps(a, b1, r11);
+        a = _mm256_set1_ps(pa[p * 6 + 2]);
+        r20 = _mm256_fmadd_ps(a, b0, r20); r21 = _mm256_fmadd_ps(a, b1, r21);
+        a = _mm256_set1_ps(pa[p * 6 + 3]);
+        r30 = _mm256_fmadd_ps(a, b0, r30); r31 = _mm256_fmadd_ps(a, b1, r31);
+        a = _mm256_set1_ps(pa[p * 6 + 4]);
+        r40 = _mm256_fmadd_ps(a, b0, r40); r41 = _mm256_fmadd_ps(a, b1, r41);
+        a = _mm256_set1_ps(pa[p * 6 + 5]);
+        r50 = _mm256_fmadd_ps(a, b0, r50); r51 = _mm256_fmadd_ps(a, b1, r51);
+    }
+    __m256 r[6][2] = {{r00, r01}, {r10, r11}, {r20, r21}, {r30, r31}, {r40, r41}, {r50, r51}};
+    if(mr == 6 && nr == 16){
+        __m256 va = _mm256_set1_ps(alpha);
+        for(size_t i = 0; i < 6; ++i){
+            float* ci = c + i * ldc;
+            _mm256_storeu_ps(ci, _mm256_fmadd_ps(va, r[i][0], _mm256_loadu_ps(ci)));
+            _mm256_storeu_ps(ci + 8, _mm256_fmadd_ps(va, r[i][1], _mm256_loadu_ps(ci + 8)));
+        }
+        return;
+    }
+    alignas(64) float acc[6 * 16];
+    for(size_t i = 0; i < 6; ++i){
+        _mm256_store_ps(acc + i * 16, r[i][0]);
+        _mm256_store_ps(acc + i * 16 + 8, r[i][1]);
+    }
+    simd_gemm_partial<float>(acc, alpha, c, ldc, mr, nr);
+};
+
+LINALG_TARGET("avx2,fma")
+inline void simd_gemm_avx2(size_t kc, const double* pa, const double* pb, double alpha, double* c, size_t ldc, size_t mr, size_t nr){
+    __m256d r00 = _mm256_setzero_pd(), r01 = _mm256_setzero_pd();
+    __m256d r10 = _mm256_setzero_pd(), r11 = _mm256_setzero_pd();
+    __m256d r20 = _mm256_setzero_pd(), r21 = _mm256_setzero_pd();
+    __m256d r30 = _mm256_setzero_pd(), r31 = _mm256_setzero_pd();
+    __m256d r40 = _mm256_setzero_pd(), r41 = _mm256_setzero_pd();
+    __m256d r50 = _mm256_setzero_pd(), r51 = _mm256_setzero_pd();
+    for(size_t p = 0; p < kc; ++p){
+        const double* bp = pb + p * 8;
+        __m256d b0 = _mm256_loadu_pd(bp), b1 = _mm256_loadu_pd(bp + 4), a;
+        a = _mm256_set1_pd(pa[p * 6 + 0]);
+        r00 = _mm256_fmadd_pd(a, b0, r00); r01 = _mm256_fmadd_pd(a, b1, r01);
+        a = _mm256_set1_pd(pa[p * 6 + 1]);
+        r10 = _mm256_fmadd_pd(a, b0, r10); r11 = _mm256_fmadd_pd(a, b1, r11);
+        a = _mm256_set1_pd(pa[p * 6 + 2]);
+        r20 = _mm256_fmadd_pd(a, b0, r20); r21 = _mm256_fmadd_pd(a, b1, r21);
+        a = _mm256_set1_pd(pa[p * 6 + 3]);
+        r30 = _mm256_fmadd_pd(a, b0, r30); r31 = _mm256_fmadd_pd(a, b1, r31);
+        a = _mm256_set1_pd(pa[p * 6 + 4]);
+        r40 = _mm256_fmadd_pd(a, b0, r40); r41 = _mm256_fmadd_pd(a, b1, r41);
+        a = _mm256_set1_pd(pa[p * 6 + 5]);
+        r50 = _mm256_fmadd_pd(a, b0, r50); r51 = _mm256_fmadd_pd(a, b1, r51);
+    }
+    __m256d r[6][2] = {{r00, r01}, {r10, r11}, {r20, r21}, {r30, r31}, {r40, r41}, {r50, r51}};
+    if(mr == 6 && nr == 8){
+        __m256d va = _mm256_set1_pd(alpha);
+        for(size_t i = 0; i < 6; ++i){
+            double* ci = c + i * ldc;
+            _mm256_storeu_pd(ci, _mm256_fmadd_pd(va, r[i][0], _mm256_loadu_pd(ci)));
+            _mm256_storeu_pd(ci + 4, _mm256_fmadd_pd(va, r[i][1], _mm256_loadu_pd(ci + 4)));
+        }
+        return;
+    }
+    alignas(64) double acc[6 * 8];
+    for(size_t i = 0; i < 6; ++i){
+        _mm256_store_pd(acc + i * 8, r[i][0]);
+        _mm256_store_pd(acc + i * 8 + 4, r[i][1]);
+    }
+    simd_gemm_partial<double>(acc, alpha, c, ldc, mr, nr);
+};
+
+// int32 tile for the int8 / int16 products of quant.hpp, mullo + add
+LINALG_TARGET("avx2,fma")
+inline void simd_gemm_avx2(size_t kc, const std::int32_t* pa, const std::int32_t* pb, std::int32_t alpha, std::int32_t* c, size_t ldc, size_t mr, size_t nr){
+    __m256i r00 = _mm256_setzero_si256();
+    __m256i r01 = _mm256_setzero_si256();
+    __m256i r10 = _mm256_setzero_si256();
+    __m256i r11 = _mm256_setzero_si256();
+    __m256i r20 = _mm256_setzero_si256();
+    __m256i r21 = _mm256_setzero_si256();
+    __m256i r30 = _mm256_setzero_si256();
+    __m256i r31 = _mm256_setzero_si256();
+    __m256i r40 = _mm256_setzero_si256();
+    __m256i r41 = _mm256_setzero_si256();
+    __m256i r50 = _mm256_setzero_si256();
+    __m256i r51 = _mm256_setzero_si256();
+    for(size_t p = 0; p < kc; ++p){
+        const std::int32_t* bp = pb + p * 16;
+        __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bp));
+        __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bp + 8)), a;
+        a = _mm256_set1_epi32(pa[p * 6 + 0]);
+        r00 = _mm256_add_epi32(r00, _mm256_mullo_epi32(a, b0));
+        r01 = _mm256_add_epi32(r01, _mm256_mullo_epi32(a, b1));
+        a = _mm256_set1_epi32(pa[p * 6 + 1]);
+        r10 = _mm256_add_epi32(r10, _mm256_mullo_epi32(a, b0));
+        r11 = _mm256_add_epi32(r11, _mm256_mullo_epi32(a, b1));
+        a = _mm256_set1_epi32(pa[p * 6 + 2]);
+        r20 = _mm256_add_epi32(r20, _mm256_mullo_epi32(a, b0));
+        r21 = _mm256_add_epi32(r21, _mm256_mullo_epi32(a, b1));
+        a = _mm256_set1_epi32(pa[p * 6 + 3]);
+        r30 = _mm256_add_epi32(r30, _mm256_mullo_epi32(a, b0));
+        r31 = _mm256_add_epi32(r31, _mm256_mullo_epi32(a, b1));
+        a = _mm256_set1_epi32(pa[p * 6 + 4]);
+        r40 = _mm256_add_epi32(r40, _mm256_mullo_epi32(a, b0));
+        r41 = _mm256_add_epi32(r41, _mm256_mullo_epi32(a, b1));
+        a = _mm256_set1_epi32(pa[p * 6 + 5]);
+        r50 = _mm256_add_epi32(r50, _mm256_mullo_epi32(a, b0));
+        r51 = _mm256_add_epi32(r51, _mm256_mullo_epi32(a, b1));
+    }
+    __m256i r[12] = {r00, r01, r10, r11, r20, r21, r30, r31, r40, r41, r50, r51};
+    if(mr == 6 && nr == 16){
+        __m256i va = _mm256_set1_epi32(alpha);
+        for(size_t i = 0; i < 6; ++i){
+            for(size_t j = 0; j < 2; ++j){
+                __m256i* ci = reinterpret_cast<__m256i*>(c + i * ldc + j * 8);
+                _mm256_storeu_si256(ci, _mm256_add_epi32(_mm256_mullo_epi32(va, r[i * 2 + j]), _mm256_loadu_si256(ci)));
+            }
+        }
+        return;
+    }
+    alignas(32) std::int32_t acc[6 * 16];
+    for(size_t i = 0; i < 12; ++i){
+        _mm256_store_si256(reinterpret_cast<__m256i*>(acc + i * 8), r[i]);
+    }
+    simd_gemm_partial<std::int32_t>(acc, alpha, c, ldc, mr, nr);
+};
+
+// ---- avx512f ----
+
+LINALG_TARGET("avx512f")
+inline void simd_addsub_avx512(const float* a, const float* b, float* t, size_t n, bool sub){
+    size_t i = 0;
+    if(sub){
+        for(; i + 16 <= n; i += 16)_mm512_storeu_ps(t + i, _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        for(; i < n; ++i)t[i] = a[i] - b[i];
+    }else{
+        for(; i + 16 <= n; i += 16)_mm512_storeu_ps(t + i, _mm512_add_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i)));
+        for(; i < n; ++i)t[i] = a[i] + b[i];
+    }
+};
+
+LINALG_TARGET("avx512f")
+inline void simd_addsub_avx512(const double* a, const double* b, double* t, size_t n, bool sub){
+    size_t i = 0;
+    if(sub){
+        for(; i + 8 <= n; i += 8)_mm512_storeu_pd(t + i, _mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i)));
+        for(; i < n; ++i)t[i] = a[i] - b[i];
+    }else{
+        for(; i + 8 <= n; i += 8)_mm512_storeu_pd(t + i, _mm512_add_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i)));
+        for(; i < n; ++i)t[i] = a[i] + b[i];
+    }
+};
+
+LINALG_TARGET("avx512f")
+inline void simd_convert_avx512(const float* s, double* d, size_t n){
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)_mm512_storeu_pd(d + i, _mm512_cvtps_pd(_mm256_loadu_ps(s + i)));
+    for(; i < n; ++i)d[i] = static_cast<double>(s[i]);
+};
+
+LINALG_TARGET("avx512f")
+inline void simd_convert_avx512(const double* s, float* d, size_t n){
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8)_mm256_storeu_ps(d + i, _mm512_cvtpd_ps(_mm512_loadu_pd(s + i)));
+    for(; i < n; ++i)d[i] = static_cast<float>(s[i]);
+};
+
+LINALG_TARGET("avx512f")
+inline void simd_convert_avx512(const std::int32_t* s, float* d, size_t n){
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16)_mm512_storeu_ps(d + i, _mm512_cvtepi32_ps(_mm512_loadu_si512(s + i)));
+    for(; i < n; ++i)d[i] = static_cast<float>(s[i]);
+};
+
+LINALG_TARGET("avx512f")
+inline void simd_convert_avx512(const float* s, std::int32_t* d, size_t n){
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16)_mm512_storeu_si512(d + i, _mm512_cvttps_epi32(_mm512_loadu_ps(s + i)));
+    for(; i < n; ++i)d[i] = static_cast<std::int32_t>(s[i]);
+};
+
+// same 6 x NR tile as the other isa so the packed panels stay identical, one zmm per row
+LINALG_TARGET("avx512f")
+inline void simd_gemm_avx512(size_t kc, const float* pa, const float* pb, float alpha, float* c, size_t ldc, size_t mr, size_t nr){
+    __m512 r00 = _mm512_setzero_ps();
+    __m512 r10 = _mm512_setzero_ps();
+    __m512 r20 = _mm512_setzero_ps();
+    __m512 r30 = _mm512_setzero_ps();
+    __m512 r40 = _mm512_setzero_ps();
+    __m512 r50 = _mm512_setzero_ps();
+    for(size_t p = 0; p < kc; ++p){
+        const float* bp = pb + p * 16;
+        __m512 b0 = _mm512_loadu_ps(bp), a;
+        a = _mm512_set1_ps(pa[p * 6 + 0]);
+        r00 = _mm512_fmadd_ps(a, b0, r00);
+        a = _mm512_set1_ps(pa[p * 6 + 1]);
+        r10 = _mm512_fmadd_ps(a, b0, r10);
+        a = _mm512_set1_ps(pa[p * 6 + 2]);
+        r20 = _mm512_fmadd_ps(a, b0, r20);
+        a = _mm512_set1_ps(pa[p * 6 + 3]);
+        r30 = _mm512_fmadd_ps(a, b0, r30);
+        a = _mm512_set1_ps(pa[p * 6 + 4]);
+        r40 = _mm512_fmadd_ps(a, b0, r40);
+        a = _mm512_set1_ps(pa[p * 6 + 5]);
+        r50 = _mm512_fmadd_ps(a, b0, r50);
+    }
+    __m512 r[6] = {r00, r10, r20, r30, r40, r50};
+    if(mr == 6 && nr == 16){
+        __m512 va = _mm512_set1_ps(alpha);
+        for(size_t i = 0; i < 6; ++i){
+            float* ci = c + i * ldc;
+            _mm512_storeu_ps(ci, _mm512_fmadd_ps(va, r[i], _mm512_loadu_ps(ci)));
+        }
+        return;
+    }
+    alignas(64) float acc[6 * 16];
+    for(size_t i = 0; i < 6; ++i){
+        _mm512_store_ps(acc + i * 16, r[i]);
+    }
+    simd_gemm_partial<float>(acc, alpha, c, ldc, mr, nr);
+};
+
+LINALG_TARGET("avx512f")
+inline void simd_gemm_avx512(size_t kc, const double* pa, const double* pb, double alpha, double* c, size_t ldc, size_t mr, size_t nr){
+    __m512d r00 = _mm512_setzero_pd();
+    __m512d r10 = _mm512_setzero_pd();
+    __m512d r20 = _mm512_setzero_pd();
+    __m512d r30 = _mm512_setzero_pd();
+    __m512d r40 = _mm512_setzero_pd();
+    __m512d r50 = _mm512_setzero_pd();
+    for(size_t p = 0; p < kc; ++p){
+        const double* bp = pb + p * 8;
+        __m512d b0 = _mm512_loadu_pd(bp), a;
+        a = _mm512_set1_pd(pa[p * 6 + 0]);
+        r00 = _mm512_fmadd_pd(a, b0, r00);
+        a = _mm512_set1_pd(pa[p * 6 + 1]);
+        r10 = _mm512_fmadd_pd(a, b0, r10);
+        a = _mm512_set1_pd(pa[p * 6 + 2]);
+        r20 = _mm512_fmadd_pd(a, b0, r20);
+        a = _mm512_set1_pd(pa[p * 6 + 3]);
+        r30 = _mm512_fmadd_pd(a, b0, r30);
+        a = _mm512_set1_pd(pa[p * 6 + 4]);
+        r40 = _mm512_fmadd_pd(a, b0, r40);
+        a = _mm512_set1_pd(pa[p * 6 + 5]);
+        r50 = _mm512_fmadd_pd(a, b0, r50);
+    }
+    __m512d r[6] = {r00, r10, r20, r30, r40, r50};
+    if(mr == 6 && nr == 8){
+        __m512d va = _mm512_set1_pd(alpha);
+        for(size_t i = 0; i < 6; ++i){
+            double* ci = c + i * ldc;
+            _mm512_storeu_pd(ci, _mm512_fmadd_pd(va, r[i], _mm512_loadu_pd(ci)));
+        }
+        return;
+    }
+    alignas(64) double acc[6 * 8];
+    for(size_t i = 0; i < 6; ++i){
+        _mm512_store_pd(acc + i * 8, r[i]);
+    }
+    simd_gemm_partial<double>(acc, alpha, c, ldc, mr, nr);
+};
+
+// int32 tile for the int8 / int16 products of quant.hpp, mullo + add
+LINALG_TARGET("avx512f")
+inline void simd_gemm_avx512(size_t kc, const std::int32_t* pa, const std::int32_t* pb, std::int32_t alpha, std::int32_t* c, size_t ldc, size_t mr, size_t nr){
+    __m512i r00 = _mm512_setzero_si512();
+    __m512i r10 = _mm512_setzero_si512();
+    __m512i r20 = _mm512_setzero_si512();
+    __m512i r30 = _mm512_setzero_si512();
+    __m512i r40 = _mm512_setzero_si512();
+    __m512i r50 = _mm512_setzero_si512();
+    for(size_t p = 0; p < kc; ++p){
+        const std::int32_t* bp = pb + p * 16;
+        __m512i b0 = _mm512_loadu_si512(bp), a;
+        a = _mm512_set1_epi32(pa[p * 6 + 0]);
+        r00 = _mm512_add_epi32(r00, _mm512_mullo_epi32(a, b0));
+        a = _mm512_set1_epi32(pa[p * 6 + 1]);
+        r10 = _mm512_add_epi32(r10, _mm512_mullo_epi32(a, b0));
+        a = _mm512_set1_epi32(pa[p * 6 + 2]);
+        r20 = _mm512_add_epi32(r20, _mm512_mullo_epi32(a, b0));
+        a = _mm512_set1_epi32(pa[p * 6 + 3]);
+        r30 = _mm512_add_epi32(r30, _mm512_mullo_epi32(a, b0));
+        a = _mm512_set1_epi32(pa[p * 6 + 4]);
+        r40 = _mm512_add_epi32(r40, _mm512_mullo_epi32(a, b0));
+        a = _mm512_set1_epi32(pa[p * 6 + 5]);
+        r50 = _mm512_add_epi32(r50, _mm512_mullo_epi32(a, b0));
+    }
+    __m512i r[6] = {r00, r10, r20, r30, r40, r50};
+    if(mr == 6 && nr == 16){
+        __m512i va = _mm512_set1_epi32(alpha);
+        for(size_t i = 0; i < 6; ++i){
+            std::int32_t* ci = c + i * ldc;
+            _mm512_storeu_si512(ci, _mm512_add_epi32(_mm512_mullo_epi32(va, r[i]), _mm512_loadu_si512(ci)));
+        }
+        return;
+    }
+    alignas(64) std::int32_t acc[6 * 16];
+    for(size_t i = 0; i < 6; ++i){
+        _mm512_store_si512(acc + i * 16, r[i]);
+    }
+    simd_gemm_partial<std::int32_t>(acc, alpha, c, ldc, mr, nr);
+};
+
+#endif
+
+// ---- dispatch ----
+
+template <typename E>
+constexpr bool simd_supported_v = std::is_same_v<E, float> || std::is_same_v<E, double>;
+
+// element types with an explicit gemm tile, int32 only from avx2 on
+template <typename E>
+constexpr bool simd_gemm_supported_v = simd_supported_v<E> || std::is_same_v<E, std::int32_t>;
+
+template <typename From, typename To>
+constexpr bool simd_convert_supported_v =
+    (std::is_same_v<From, float> && std::is_same_v<To, double>) ||
+    (std::is_same_v<From, double> && std::is_same_v<To, float>) ||
+    (std::is_same_v<From, std::int32_t> && std::is_same_v<To, float>) ||
+    (std::is_same_v<From, float> && std::is_same_v<To, std::int32_t>);
+
+template <typename E>
+inline void simd_addsub(const E* a, const E* b, E* t, size_t n, bool sub){
+#if defined(LINALG_X86)
+    if constexpr (simd_supported_v<E>){
+        switch(simd_active()){
+            case simd_level::avx512: simd_addsub_avx512(a, b, t, n, sub); return;
+            case simd_level::avx2: simd_addsub_avx2(a, b, t, n, sub); return;
+            case simd_level::sse2: simd_addsub_sse2(a, b, t, n, sub); return;
+            default: break;
+        }
+    }
+#endif
+    if(sub){
+        simd_sub_scalar<E>(a, b, t, n);
+    }else{
+        simd_add_scalar<E>(a, b, t, n);
+    }
+};
+
+template <typename E>
+inline void simd_add(const E* a, const E* b, E* t, size_t n){
+    simd_addsub<E>(a, b, t, n, false);
+};
+
+template <typename E>
+inline void simd_sub(const E* a, const E* b, E* t, size_t n){
+    simd_addsub<E>(a, b, t, n, true);
+};
+
+// s and d must not overlap, see mat_convert_inplace for same-size conversions in place
+template <typename From, typename To>
+inline void simd_convert(const From* s, To* d, size_t n){
+#if defined(LINALG_X86)
+    if constexpr (simd_convert_supported_v<From, To>){
+        switch(simd_active()){
+            case simd_level::avx512: simd_convert_avx512(s, d, n); return;
+            case simd_level::avx2: simd_convert_avx2(s, d, n); return;
+            case simd_level::sse2: simd_convert_sse2(s, d, n); return;
+            default: break;
+        }
+    }
+#endif
+    simd_convert_scalar<From, To>(s, d, n);
+};
+
+// nullptr when the generic c++ micro kernel of gemm_engine should be used
+template <typename E>
+inline simd_gemm_kernel_t<E> simd_gemm_kernel(){
+#if defined(LINALG_X86)
+    if constexpr (std::is_same_v<E, std::int32_t>){
+        switch(simd_active()){
+            case simd_level::avx512: return static_cast<simd_gemm_kernel_t<E>>(&simd_gemm_avx512);
+            case simd_level::avx2: return static_cast<simd_gemm_kernel_t<E>>(&simd_gemm_avx2);
+            default: break;
+        }
+    }else if constexpr (simd_supported_v<E>){
+        switch(simd_active()){
+            case simd_level::avx512: return static_cast<simd_gemm_kernel_t<E>>(&simd_gemm_avx512);
+            case simd_level::avx2: return static_cast<simd_gemm_kernel_t<E>>(&simd_gemm_avx2);
+            case simd_level::sse2: return static_cast<simd_gemm_kernel_t<E>>(&simd_gemm_sse2);
+            default: break;
+        }
+    }
+#endif
+    return nullptr;
+};
+
+#endif
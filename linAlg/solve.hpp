@@ -0,0 +1,378 @@
+#ifndef _SRC_LINEARALGEBRA_SOLVE_H__
+#define _SRC_LINEARALGEBRA_SOLVE_H__
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <type_traits>
+
+#include "gemm.hpp"
+
+// blocked right-looking LU (partial pivoting) and Cholesky on row-major storage.
+// the panel is factored column by column, the trailing matrix is updated by gemm,
+// so the O(n^3) part runs through the same packed, tile-parallel engine as mat_mul.
+
+constexpr size_t FACTOR_NB = 64;
+// rows below this are not worth an OpenMP region inside the panel
+constexpr size_t FACTOR_PAR_ROWS = 256;
+
+// a = P*L*U in place, L unit lower. piv[j] is the row swapped with j at step j.
+// returns false when a zero pivot was met, the factorization is then not usable for solving
+template <typename E>
+bool lu_factor_inplace(E* a, size_t n, size_t lda, size_t* piv){
+    using std::abs;
+    bool regular = true;
+    for(size_t k0 = 0; k0 < n; k0 += FACTOR_NB){
+        size_t kb = std::min(FACTOR_NB, n - k0), k1 = k0 + kb;
+        for(size_t j = k0; j < k1; ++j){
+            size_t p = j;
+            for(size_t i = j + 1; i < n; ++i){
+                if(abs(a[i * lda + j]) > abs(a[p * lda + j]))p = i;
+            }
+            piv[j] = p;
+            if(p != j)std::swap_ranges(a + j * lda, a + j * lda + n, a + p * lda);
+            E d = a[j * lda + j];
+            if(d == E(0)){
+                regular = false;
+                continue;
+            }
+            const E* uj = a + j * lda;
+            #pragma omp parallel for if(n - j > FACTOR_PAR_ROWS)
+            for(size_t i = j + 1; i < n; ++i){
+                E* ai = a + i * lda;
+                E l = ai[j] /= d;
+                for(size_t c = j + 1; c < k1; ++c)ai[c] -= l * uj[c];
+            }
+        }
+        if(k1 == n)break;
+        // U12 = L11^-1 * A12
+        #pragma omp parallel for if(n - k1 > FACTOR_PAR_ROWS)
+        for(size_t c0 = k1; c0 < n; c0 += FACTOR_NB){
+            size_t c1 = std::min(n, c0 + FACTOR_NB);
+            for(size_t i = k0 + 1; i < k1; ++i){
+                E* ai = a + i * lda;
+                for(size_t j = k0; j < i; ++j){
+                    E l = ai[j];
+                    const E* uj = a + j * lda;
+                    for(size_t c = c0; c < c1; ++c)ai[c] -= l * uj[c];
+                }
+            }
+        }
+        // A22 -= L21 * U12
+        gemm<E>(n - k1, n - k1, kb, E(-1), a + k1 * lda + k0, lda, a + k0 * lda + k1, lda, a + k1 * lda + k1, lda);
+    }
+    return regular;
+};
+
+// a = L*L^T in place for symmetric positive definite a, only the lower triangle is read,
+// the strict upper triangle is zeroed. returns false when a is not positive definite
+template <typename E>
+bool cholesky_factor_inplace(E* a, size_t n, size_t lda){
+    using std::sqrt;
+    std::vector<E> panel_t;
+    for(size_t k0 = 0; k0 < n; k0 += FACTOR_NB){
+        size_t kb = std::min(FACTOR_NB, n - k0), k1 = k0 + kb;
+        // L11
+        for(size_t j = k0; j < k1; ++j){
+            E* aj = a + j * lda;
+            E d = aj[j];
+            for(size_t p = k0; p < j; ++p)d -= aj[p] * aj[p];
+            if(!(d > E(0)))return false;
+            d = sqrt(d);
+            aj[j] = d;
+            for(size_t i = j + 1; i < k1; ++i){
+                E* ai = a + i * lda;
+                E s = ai[j];
+                for(size_t p = k0; p < j; ++p)s -= ai[p] * aj[p];
+                ai[j] = s / d;
+            }
+        }
+        if(k1 == n)break;
+        // L21 = A21 * L11^-T
+        #pragma omp parallel for if(n - k1 > FACTOR_PAR_ROWS)
+        for(size_t i = k1; i < n; ++i){
+            E* ai = a + i * lda;
+            for(size_t j = k0; j < k1; ++j){
+                const E* lj = a + j * lda;
+                E s = ai[j];
+                for(size_t p = k0; p < j; ++p)s -= ai[p] * lj[p];
+                ai[j] = s / lj[j];
+            }
+        }
+        // A22 -= L21 * L21^T, gemm wants L21^T row-major
+        size_t m = n - k1;
+        panel_t.resize(kb * m);
+        #pragma omp parallel for if(m > FACTOR_PAR_ROWS)
+        for(size_t i = 0; i < m; ++i){
+            for(size_t j = 0; j < kb; ++j)panel_t[j * m + i] = a[(k1 + i) * lda + k0 + j];
+        }
+        gemm<E>(m, m, kb, E(-1), a + k1 * lda + k0, lda, panel_t.data(), m, a + k1 * lda + k1, lda);
+    }
+    for(size_t i = 0; i < n; ++i){
+        std::fill(a + i * lda + i + 1, a + i * lda + n, E(0));
+    }
+    return true;
+};
+
+// diagonal block of a triangular solve, b rows [i0, i1) for all nrhs columns
+template <typename E>
+void trsm_block_lower(const E* l, size_t ldl, bool unit, size_t i0, size_t i1, E* b, size_t nrhs, size_t ldb){
+    #pragma omp parallel for if(nrhs > FACTOR_PAR_ROWS)
+    for(size_t c0 = 0; c0 < nrhs; c0 += FACTOR_NB){
+        size_t c1 = std::min(nrhs, c0 + FACTOR_NB);
+        for(size_t i = i0; i < i1; ++i){
+            E* bi = b + i * ldb;
+            for(size_t j = i0; j < i; ++j){
+                E f = l[i * ldl + j];
+                const E* bj = b + j * ldb;
+                for(size_t c = c0; c < c1; ++c)bi[c] -= f * bj[c];
+            }
+            if(!unit){
+                E d = l[i * ldl + i];
+                for(size_t c = c0; c < c1; ++c)bi[c] /= d;
+            }
+        }
+    }
+};
+
+template <typename E>
+void trsm_block_upper(const E* u, size_t ldu, size_t i0, size_t i1, E* b, size_t nrhs, size_t ldb){
+    #pragma omp parallel for if(nrhs > FACTOR_PAR_ROWS)
+    for(size_t c0 = 0; c0 < nrhs; c0 += FACTOR_NB){
+        size_t c1 = std::min(nrhs, c0 + FACTOR_NB);
+        for(size_t i = i1; i-- > i0;){
+            E* bi = b + i * ldb;
+            for(size_t j = i + 1; j < i1; ++j){
+                E f = u[i * ldu + j];
+                const E* bj = b + j * ldb;
+                for(size_t c = c0; c < c1; ++c)bi[c] -= f * bj[c];
+            }
+            E d = u[i * ldu + i];
+            for(size_t c = c0; c < c1; ++c)bi[c] /= d;
+        }
+    }
+};
+
+// b = L^-1 b, blocks below the diagonal go through gemm
+template <typename E>
+void trsm_lower(const E* l, size_t n, size_t ldl, bool unit, E* b, size_t nrhs, size_t ldb){
+    for(size_t k0 = 0; k0 < n; k0 += FACTOR_NB){
+        size_t k1 = std::min(n, k0 + FACTOR_NB);
+        trsm_block_lower<E>(l, ldl, unit, k0, k1, b, nrhs, ldb);
+        if(k1 < n){
+            gemm<E>(n - k1, nrhs, k1 - k0, E(-1), l + k1 * ldl + k0, ldl, b + k0 * ldb, ldb, b + k1 * ldb, ldb);
+        }
+    }
+};
+
+// b = U^-1 b
+template <typename E>
+void trsm_upper(const E* u, size_t n, size_t ldu, E* b, size_t nrhs, size_t ldb){
+    for(size_t k1 = n; k1 > 0;){
+        size_t k0 = k1 > FACTOR_NB ? k1 - FACTOR_NB : 0;
+        trsm_block_upper<E>(u, ldu, k0, k1, b, nrhs, ldb);
+        if(k0 > 0){
+            gemm<E>(k0, nrhs, k1 - k0, E(-1), u + k0, ldu, b + k0 * ldb, ldb, b, ldb);
+        }
+        k1 = k0;
+    }
+};
+
+// b = L^-T b for a non-unit lower L, the off-diagonal block is transposed once per step
+template <typename E>
+void trsm_lower_transposed(const E* l, size_t n, size_t ldl, E* b, size_t nrhs, size_t ldb){
+    std::vector<E> block_t;
+    for(size_t k1 = n; k1 > 0;){
+        size_t k0 = k1 > FACTOR_NB ? k1 - FACTOR_NB : 0, kb = k1 - k0;
+        #pragma omp parallel for if(nrhs > FACTOR_PAR_ROWS)
+        for(size_t c0 = 0; c0 < nrhs; c0 += FACTOR_NB){
+            size_t c1 = std::min(nrhs, c0 + FACTOR_NB);
+            for(size_t i = k1; i-- > k0;){
+                E* bi = b + i * ldb;
+                for(size_t j = i + 1; j < k1; ++j){
+                    E f = l[j * ldl + i];
+                    const E* bj = b + j * ldb;
+                    for(size_t c = c0; c < c1; ++c)bi[c] -= f * bj[c];
+                }
+                E d = l[i * ldl + i];
+                for(size_t c = c0; c < c1; ++c)bi[c] /= d;
+            }
+        }
+        if(k0 > 0){
+            // (L^T)[0:k0, k0:k1] = (L[k0:k1, 0:k0])^T
+            block_t.resize(k0 * kb);
+            for(size_t i = 0; i < kb; ++i){
+                for(size_t j = 0; j < k0; ++j)block_t[j * kb + i] = l[(k0 + i) * ldl + j];
+            }
+            gemm<E>(k0, nrhs, kb, E(-1), block_t.data(), kb, b + k0 * ldb, ldb, b, ldb);
+        }
+        k1 = k0;
+    }
+};
+
+// ---- mat / heap_mat front end ----
+
+template <size_t d1, size_t d2, typename E>
+struct mat_shape<mat<d1, d2, E>>{
+    constexpr static size_t rows = d1;
+    constexpr static size_t cols = d2;
+    using value_type = E;
+};
+
+template <size_t d1, size_t d2, typename E>
+E* mat_data(mat<d1, d2, E>& m){return &(m.e[0][0]);};
+
+template <size_t d1, size_t d2, typename E>
+const E* mat_data(const mat<d1, d2, E>& m){return &(m.e[0][0]);};
+
+template <size_t d1, size_t d2, typename E, template <typename T> typename _Alloc>
+E* mat_data(heap_mat<d1, d2, E, _Alloc>& m){return &(m->e[0][0]);};
+
+template <size_t d1, size_t d2, typename E, template <typename T> typename _Alloc>
+const E* mat_data(const heap_mat<d1, d2, E, _Alloc>& m){return &(m->e[0][0]);};
+
+// mat keeps its pivots on the stack as well
+template <typename M, size_t n>
+using factor_pivots_t = std::conditional_t<is_heap_mat_v<M>, std::vector<size_t>, std::array<size_t, n>>;
+
+// factorization of a square mat or heap_mat, reused for any number of right-hand sides
+template <typename M>
+class lu_factor{
+public:
+    constexpr static size_t n = mat_shape<M>::rows;
+    using E = typename mat_shape<M>::value_type;
+    static_assert(mat_shape<M>::cols == n, "lu needs a square matrix");
+private:
+    M f;
+    factor_pivots_t<M, n> piv;
+    bool regular;
+public:
+    explicit lu_factor(const M& a):f(a), piv(), regular(){
+        if constexpr (is_heap_mat_v<M>)piv.resize(n);
+        regular = lu_factor_inplace<E>(mat_data(f), n, n, piv.data());
+    };
+
+    // false for a singular matrix
+    bool ok()const{return regular;};
+
+    const M& factors()const{return f;};
+
+    E det()const{
+        const E* a = mat_data(f);
+        E d = E(1);
+        for(size_t i = 0; i < n; ++i){
+            d *= a[i * n + i];
+            if(piv[i] != i)d = -d;
+        }
+        return d;
+    };
+
+    // x with A*x = b, for b of shape n x k, in place
+    template <typename B>
+    void solve_inplace(B& b)const{
+        static_assert(mat_shape<B>::rows == n, "right-hand side shape mismatch");
+        assert(regular);
+        constexpr size_t k = mat_shape<B>::cols;
+        E* x = mat_data(b);
+        for(size_t i = 0; i < n; ++i){
+            if(piv[i] != i)std::swap_ranges(x + i * k, x + i * k + k, x + piv[i] * k);
+        }
+        trsm_lower<E>(mat_data(f), n, n, true, x, k, k);
+        trsm_upper<E>(mat_data(f), n, n, x, k, k);
+    };
+
+    template <typename B>
+    B solve(const B& b)const{
+        B x(b);
+        solve_inplace(x);
+        return x;
+    };
+
+    M inverse()const{
+        M x(f);
+        E* p = mat_data(x);
+        std::fill(p, p + n * n, E(0));
+        for(size_t i = 0; i < n; ++i)p[i * n + i] = E(1);
+        solve_inplace(x);
+        return x;
+    };
+};
+
+template <typename M>
+class cholesky_factor{
+public:
+    constexpr static size_t n = mat_shape<M>::rows;
+    using E = typename mat_shape<M>::value_type;
+    static_assert(mat_shape<M>::cols == n, "cholesky needs a square matrix");
+private:
+    M f;
+    bool spd;
+public:
+    explicit cholesky_factor(const M& a):f(a), spd(){
+        spd = cholesky_factor_inplace<E>(mat_data(f), n, n);
+    };
+
+    // false when the matrix is not symmetric positive definite
+    bool ok()const{return spd;};
+
+    // lower triangular L with A = L*L^T
+    const M& factors()const{return f;};
+
+    E det()const{
+        const E* a = mat_data(f);
+        E d = E(1);
+        for(size_t i = 0; i < n; ++i)d *= a[i * n + i];
+        return d * d;
+    };
+
+    template <typename B>
+    void solve_inplace(B& b)const{
+        static_assert(mat_shape<B>::rows == n, "right-hand side shape mismatch");
+        assert(spd);
+        constexpr size_t k = mat_shape<B>::cols;
+        E* x = mat_data(b);
+        trsm_lower<E>(mat_data(f), n, n, false, x, k, k);
+        trsm_lower_transposed<E>(mat_data(f), n, n, x, k, k);
+    };
+
+    template <typename B>
+    B solve(const B& b)const{
+        B x(b);
+        solve_inplace(x);
+        return x;
+    };
+
+    M inverse()const{
+        M x(f);
+        E* p = mat_data(x);
+        std::fill(p, p + n * n, E(0));
+        for(size_t i = 0; i < n; ++i)p[i * n + i] = E(1);
+        solve_inplace(x);
+        return x;
+    };
+};
+
+template <typename M, size_t = mat_shape<M>::rows>
+lu_factor<M> lu(const M& a){
+    return lu_factor<M>(a);
+};
+
+template <typename M, size_t = mat_shape<M>::rows>
+cholesky_factor<M> cholesky(const M& a){
+    return cholesky_factor<M>(a);
+};
+
+// A^-1 * B without forming A^-1
+template <typename M, typename B, size_t = mat_shape<M>::rows>
+B solve(const M& a, const B& b){
+    return lu_factor<M>(a).solve(b);
+};
+
+template <typename M, size_t = mat_shape<M>::rows>
+M inverse(const M& a){
+    return lu_factor<M>(a).inverse();
+};
+
+#endif
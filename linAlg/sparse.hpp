@@ -0,0 +1,359 @@
+#ifndef _SRC_LINEARALGEBRA_SPARSE_H__
+#define _SRC_LINEARALGEBRA_SPARSE_H__
+
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "mat.hpp"
+#include "../vectorn.hpp"
+
+// compressed sparse matrix with static shape.
+// csr compresses rows (ptr has d1+1 entries, idx holds column indices), csc compresses
+// columns. memory is O(nnz + lines), every kernel runs in O(nnz) or O(flops) time.
+// csr of A has the same arrays as csc of A^T, so transpose() only relabels.
+
+enum class sparse_layout{
+    csr,
+    csc,
+};
+
+constexpr sparse_layout sparse_other(sparse_layout l){
+    return l == sparse_layout::csr ? sparse_layout::csc : sparse_layout::csr;
+};
+
+// nonzeros per parallel work item of the row-balanced kernels
+constexpr size_t SPARSE_CHUNK_NNZ = 8192;
+
+inline size_t sparse_max_threads(){
+#ifdef _OPENMP
+    return static_cast<size_t>(omp_get_max_threads());
+#else
+    return 1;
+#endif
+};
+
+// split [0, lines) into parts of roughly equal nonzero count (+1 per line for the loop cost),
+// returns parts+1 boundaries
+inline std::vector<size_t> sparse_balance(const std::vector<size_t>& ptr){
+    size_t lines = ptr.size() - 1, work = ptr.back() + lines;
+    size_t parts = std::max<size_t>(1, std::min(lines, work / SPARSE_CHUNK_NNZ));
+    std::vector<size_t> bounds(parts + 1, lines);
+    bounds[0] = 0;
+    for(size_t p = 1; p < parts; ++p){
+        size_t target = work * p / parts, lo = bounds[p - 1], hi = lines;
+        while(lo < hi){
+            size_t mid = (lo + hi) / 2;
+            if(ptr[mid] + mid < target)lo = mid + 1; else hi = mid;
+        }
+        bounds[p] = lo;
+    }
+    return bounds;
+};
+
+// c = a * b on csr arrays, b has `width` columns. two passes over row-balanced parts:
+// count the distinct columns of every output row, then fill with a dense accumulator
+template <typename I, typename E>
+void sparse_gustavson(const std::vector<size_t>& ap, const std::vector<I>& ai, const std::vector<E>& av,
+                      const std::vector<size_t>& bp, const std::vector<I>& bi, const std::vector<E>& bv,
+                      size_t width, std::vector<size_t>& cp, std::vector<I>& ci, std::vector<E>& cv){
+    size_t rows = ap.size() - 1;
+    std::vector<size_t> bounds = sparse_balance(ap);
+    cp.assign(rows + 1, 0);
+    #pragma omp parallel
+    {
+        std::vector<size_t> mark(width, std::numeric_limits<size_t>::max());
+        #pragma omp for schedule(dynamic)
+        for(size_t p = 0; p < bounds.size() - 1; ++p){
+            for(size_t i = bounds[p]; i < bounds[p + 1]; ++i){
+                size_t n = 0;
+                for(size_t q = ap[i]; q < ap[i + 1]; ++q){
+                    size_t j = ai[q];
+                    for(size_t r = bp[j]; r < bp[j + 1]; ++r){
+                        if(mark[bi[r]] != i){
+                            mark[bi[r]] = i;
+                            ++n;
+                        }
+                    }
+                }
+                cp[i + 1] = n;
+            }
+        }
+    }
+    std::partial_sum(cp.begin(), cp.end(), cp.begin());
+    ci.resize(cp.back());
+    cv.resize(cp.back());
+    #pragma omp parallel
+    {
+        std::vector<size_t> mark(width, std::numeric_limits<size_t>::max());
+        std::vector<E> acc(width, E(0));
+        #pragma omp for schedule(dynamic)
+        for(size_t p = 0; p < bounds.size() - 1; ++p){
+            for(size_t i = bounds[p]; i < bounds[p + 1]; ++i){
+                size_t n = cp[i];
+                for(size_t q = ap[i]; q < ap[i + 1]; ++q){
+                    size_t j = ai[q];
+                    E a = av[q];
+                    for(size_t r = bp[j]; r < bp[j + 1]; ++r){
+                        size_t c = bi[r];
+                        if(mark[c] != i){
+                            mark[c] = i;
+                            ci[n++] = static_cast<I>(c);
+                            acc[c] = a * bv[r];
+                        }else{
+                            acc[c] += a * bv[r];
+                        }
+                    }
+                }
+                std::sort(ci.begin() + cp[i], ci.begin() + cp[i + 1]);
+                for(size_t k = cp[i]; k < cp[i + 1]; ++k)cv[k] = acc[ci[k]];
+            }
+        }
+    }
+};
+
+template <size_t d1, size_t d2, typename E=DEFAULT_ELEMENT, sparse_layout L=sparse_layout::csr>
+class sparse_mat{
+public:
+    constexpr static sparse_layout layout = L;
+    // compressed dimension and the one stored in idx
+    constexpr static size_t lines = L == sparse_layout::csr ? d1 : d2;
+    constexpr static size_t width = L == sparse_layout::csr ? d2 : d1;
+    using index_type = std::conditional_t<(d1 <= std::numeric_limits<std::uint32_t>::max() &&
+                                           d2 <= std::numeric_limits<std::uint32_t>::max()), std::uint32_t, size_t>;
+    using triplet = std::tuple<size_t, size_t, E>;
+
+    std::vector<size_t> ptr;
+    std::vector<index_type> idx;
+    std::vector<E> val;
+
+    sparse_mat():ptr(lines + 1, 0), idx(), val(){};
+
+    size_t nnz()const{return val.size();};
+
+    // (row, col, value), any order, duplicates are summed
+    static sparse_mat from_triplets(const std::vector<triplet>& t){
+        sparse_mat ret;
+        auto line_of = [](const triplet& x){return L == sparse_layout::csr ? std::get<0>(x) : std::get<1>(x);};
+        auto pos_of = [](const triplet& x){return L == sparse_layout::csr ? std::get<1>(x) : std::get<0>(x);};
+        for(const auto& x : t){
+            assert(std::get<0>(x) < d1 && std::get<1>(x) < d2);
+            ++ret.ptr[line_of(x) + 1];
+        }
+        std::partial_sum(ret.ptr.begin(), ret.ptr.end(), ret.ptr.begin());
+        std::vector<size_t> fill(ret.ptr.begin(), ret.ptr.end() - 1);
+        std::vector<std::pair<index_type, E>> tmp(t.size());
+        for(const auto& x : t)tmp[fill[line_of(x)]++] = {static_cast<index_type>(pos_of(x)), std::get<2>(x)};
+        // sort every line and merge duplicates, then compact
+        std::vector<size_t> kept(lines + 1, 0);
+        #pragma omp parallel for schedule(dynamic, 256)
+        for(size_t i = 0; i < lines; ++i){
+            auto b = tmp.begin() + ret.ptr[i], e = tmp.begin() + ret.ptr[i + 1];
+            std::sort(b, e, [](const auto& x, const auto& y){return x.first < y.first;});
+            size_t n = 0;
+            for(auto it = b; it != e; ++it){
+                if(n > 0 && (b + n - 1)->first == it->first){
+                    (b + n - 1)->second += it->second;
+                }else{
+                    *(b + n++) = *it;
+                }
+            }
+            kept[i + 1] = n;
+        }
+        std::partial_sum(kept.begin(), kept.end(), kept.begin());
+        ret.idx.resize(kept.back());
+        ret.val.resize(kept.back());
+        #pragma omp parallel for schedule(dynamic, 256)
+        for(size_t i = 0; i < lines; ++i){
+            for(size_t k = 0; k < kept[i + 1] - kept[i]; ++k){
+                ret.idx[kept[i] + k] = tmp[ret.ptr[i] + k].first;
+                ret.val[kept[i] + k] = tmp[ret.ptr[i] + k].second;
+            }
+        }
+        ret.ptr = std::move(kept);
+        return ret;
+    };
+
+    // entries equal to zero are dropped
+    template <template <typename T> typename _Alloc>
+    static sparse_mat from_dense(const heap_mat<d1, d2, E, _Alloc>& m){
+        sparse_mat ret;
+        const E* a = &(m->e[0][0]);
+        auto at = [a](size_t line, size_t pos){return L == sparse_layout::csr ? a[line * d2 + pos] : a[pos * d2 + line];};
+        #pragma omp parallel for
+        for(size_t i = 0; i < lines; ++i){
+            size_t n = 0;
+            for(size_t j = 0; j < width; ++j)n += !(at(i, j) == E(0));
+            ret.ptr[i + 1] = n;
+        }
+        std::partial_sum(ret.ptr.begin(), ret.ptr.end(), ret.ptr.begin());
+        ret.idx.resize(ret.ptr.back());
+        ret.val.resize(ret.ptr.back());
+        #pragma omp parallel for
+        for(size_t i = 0; i < lines; ++i){
+            size_t k = ret.ptr[i];
+            for(size_t j = 0; j < width; ++j){
+                E v = at(i, j);
+                if(!(v == E(0))){
+                    ret.idx[k] = static_cast<index_type>(j);
+                    ret.val[k++] = v;
+                }
+            }
+        }
+        return ret;
+    };
+
+    template <template <typename T> typename _Alloc=DEFAULT_ALLOCATOR>
+    heap_mat<d1, d2, E, _Alloc> to_dense()const{
+        heap_mat<d1, d2, E, _Alloc> ret{static_cast<E>(0)};
+        E* a = &(ret->e[0][0]);
+        #pragma omp parallel for
+        for(size_t i = 0; i < lines; ++i){
+            for(size_t k = ptr[i]; k < ptr[i + 1]; ++k){
+                if(L == sparse_layout::csr){
+                    a[i * d2 + idx[k]] = val[k];
+                }else{
+                    a[idx[k] * d2 + i] = val[k];
+                }
+            }
+        }
+        return ret;
+    };
+
+    // same arrays read the other way round
+    sparse_mat<d2, d1, E, sparse_other(L)> transpose()const{
+        sparse_mat<d2, d1, E, sparse_other(L)> ret;
+        ret.ptr = ptr;
+        ret.idx = idx;
+        ret.val = val;
+        return ret;
+    };
+
+    // csr <-> csc of the same matrix, counting sort in O(nnz + d1 + d2)
+    sparse_mat<d1, d2, E, sparse_other(L)> convert()const{
+        sparse_mat<d1, d2, E, sparse_other(L)> ret;
+        for(size_t k = 0; k < nnz(); ++k)++ret.ptr[idx[k] + 1];
+        std::partial_sum(ret.ptr.begin(), ret.ptr.end(), ret.ptr.begin());
+        std::vector<size_t> fill(ret.ptr.begin(), ret.ptr.end() - 1);
+        ret.idx.resize(nnz());
+        ret.val.resize(nnz());
+        for(size_t i = 0; i < lines; ++i){
+            for(size_t k = ptr[i]; k < ptr[i + 1]; ++k){
+                size_t dst = fill[idx[k]]++;
+                ret.idx[dst] = static_cast<index_type>(i);
+                ret.val[dst] = val[k];
+            }
+        }
+        return ret;
+    };
+
+    // y = A * b for b of shape d2 x k (k == 1 for a vector), row-major
+    void multiply(const E* b, E* y, size_t k)const{
+        if constexpr (L == sparse_layout::csr){
+            std::vector<size_t> bounds = sparse_balance(ptr);
+            #pragma omp parallel for schedule(dynamic)
+            for(size_t p = 0; p < bounds.size() - 1; ++p){
+                for(size_t i = bounds[p]; i < bounds[p + 1]; ++i){
+                    E* yi = y + i * k;
+                    std::fill(yi, yi + k, E(0));
+                    for(size_t q = ptr[i]; q < ptr[i + 1]; ++q){
+                        E v = val[q];
+                        const E* bj = b + static_cast<size_t>(idx[q]) * k;
+                        for(size_t c = 0; c < k; ++c)yi[c] += v * bj[c];
+                    }
+                }
+            }
+        }else if(k > 1){
+            // columns scatter into rows of y, split the right-hand side columns instead
+            std::fill(y, y + d1 * k, E(0));
+            constexpr size_t cw = 64;
+            #pragma omp parallel for schedule(dynamic)
+            for(size_t c0 = 0; c0 < k; c0 += cw){
+                size_t c1 = std::min(k, c0 + cw);
+                for(size_t j = 0; j < d2; ++j){
+                    const E* bj = b + j * k;
+                    for(size_t q = ptr[j]; q < ptr[j + 1]; ++q){
+                        E v = val[q];
+                        E* yi = y + static_cast<size_t>(idx[q]) * k;
+                        for(size_t c = c0; c < c1; ++c)yi[c] += v * bj[c];
+                    }
+                }
+            }
+        }else{
+            // one private accumulator per thread, reduced afterwards
+            std::vector<size_t> bounds = sparse_balance(ptr);
+            size_t threads = std::min(sparse_max_threads(), bounds.size() - 1);
+            std::vector<E> part(threads * d1, E(0));
+            #pragma omp parallel for schedule(static, 1)
+            for(size_t t = 0; t < threads; ++t){
+                E* acc = part.data() + t * d1;
+                for(size_t p = t; p < bounds.size() - 1; p += threads){
+                    for(size_t j = bounds[p]; j < bounds[p + 1]; ++j){
+                        E xj = b[j];
+                        for(size_t q = ptr[j]; q < ptr[j + 1]; ++q)acc[idx[q]] += val[q] * xj;
+                    }
+                }
+            }
+            #pragma omp parallel for
+            for(size_t i = 0; i < d1; ++i){
+                E s = E(0);
+                for(size_t t = 0; t < threads; ++t)s += part[t * d1 + i];
+                y[i] = s;
+            }
+        }
+    };
+
+    VectorN<E, static_cast<int>(d1)> operator*(const VectorN<E, static_cast<int>(d2)>& x)const{
+        VectorN<E, static_cast<int>(d1)> y;
+        multiply(x.data.data(), y.data.data(), 1);
+        return y;
+    };
+
+    std::vector<E> operator*(const std::vector<E>& x)const{
+        assert(x.size() == d2);
+        std::vector<E> y(d1);
+        multiply(x.data(), y.data(), 1);
+        return y;
+    };
+
+    template <size_t d3, template <typename T> typename _Alloc>
+    heap_mat<d1, d3, E, _Alloc> operator*(const heap_mat<d2, d3, E, _Alloc>& b)const{
+        heap_mat<d1, d3, E, _Alloc> y;
+        multiply(&(b->e[0][0]), &(y->e[0][0]), d3);
+        return y;
+    };
+
+    // Gustavson, both operands in this layout, result in this layout.
+    // csc * csc is done as the csr product of the transposes
+    template <size_t d3, sparse_layout L2>
+    decltype(auto) operator*(const sparse_mat<d2, d3, E, L2>& other)const{
+        if constexpr (L2 != L){
+            return *this * other.convert();
+        }else if constexpr (L == sparse_layout::csr){
+            sparse_mat<d1, d3, E, L> ret;
+            sparse_gustavson(ptr, idx, val, other.ptr, other.idx, other.val, d3, ret.ptr, ret.idx, ret.val);
+            return ret;
+        }else{
+            return (other.transpose() * transpose()).transpose();
+        }
+    };
+
+    friend std::ostream& operator<<(std::ostream& os, const sparse_mat& m){
+        for(size_t i = 0; i < lines; ++i){
+            for(size_t k = m.ptr[i]; k < m.ptr[i + 1]; ++k){
+                size_t r = L == sparse_layout::csr ? i : m.idx[k], c = L == sparse_layout::csr ? m.idx[k] : i;
+                os << "(" << r << ", " << c << ")\t" << m.val[k] << std::endl;
+            }
+        }
+        return os;
+    };
+};
+
+#endif
@@ -0,0 +1,193 @@
+#pragma once
+
+// read-only or read-write memory mapping of a whole file, move-only RAII.
+// POSIX mmap or Win32 file mapping, errors throw std::runtime_error.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+class MappedFile{
+public:
+    enum class Mode{
+        Read,       // existing file, read only
+        Write,      // existing file, changes reach the file
+        Create,     // new or truncated file of the given size, read-write
+    };
+
+private:
+    void* base = nullptr;
+    std::size_t len = 0;
+    bool writable = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    [[noreturn]] static void fail(const std::string& what, const std::string& path){
+        throw std::runtime_error("MappedFile: " + what + " '" + path + "'");
+    };
+
+public:
+    MappedFile() = default;
+
+    // size is only used by Mode::Create
+    MappedFile(const std::string& path, Mode mode, std::size_t size=0):writable(mode != Mode::Read){
+#ifdef _WIN32
+        DWORD access = writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ;
+        DWORD disposition = mode == Mode::Create ? CREATE_ALWAYS : OPEN_EXISTING;
+        file = CreateFileA(path.c_str(), access, FILE_SHARE_READ, nullptr, disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(file == INVALID_HANDLE_VALUE)fail("cannot open", path);
+        if(mode == Mode::Create){
+            LARGE_INTEGER s;
+            s.QuadPart = static_cast<LONGLONG>(size);
+            if(!SetFilePointerEx(file, s, nullptr, FILE_BEGIN) || !SetEndOfFile(file)){
+                close();
+                fail("cannot resize", path);
+            }
+            len = size;
+        }else{
+            LARGE_INTEGER s;
+            if(!GetFileSizeEx(file, &s)){
+                close();
+                fail("cannot stat", path);
+            }
+            len = static_cast<std::size_t>(s.QuadPart);
+        }
+        if(len == 0)return;
+        mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+        if(!mapping){
+            close();
+            fail("cannot map", path);
+        }
+        base = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, len);
+        if(!base){
+            close();
+            fail("cannot map", path);
+        }
+#else
+        int flags = mode == Mode::Read ? O_RDONLY : (mode == Mode::Write ? O_RDWR : (O_RDWR | O_CREAT | O_TRUNC));
+        fd = ::open(path.c_str(), flags, 0644);
+        if(fd < 0)fail("cannot open", path);
+        if(mode == Mode::Create){
+            if(::ftruncate(fd, static_cast<off_t>(size)) != 0){
+                close();
+                fail("cannot resize", path);
+            }
+            len = size;
+        }else{
+            struct stat st;
+            if(::fstat(fd, &st) != 0){
+                close();
+                fail("cannot stat", path);
+            }
+            len = static_cast<std::size_t>(st.st_size);
+        }
+        if(len == 0)return;
+        base = ::mmap(nullptr, len, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+        if(base == MAP_FAILED){
+            base = nullptr;
+            close();
+            fail("cannot map", path);
+        }
+#endif
+    };
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other){
+        swap(other);
+    };
+
+    MappedFile& operator=(MappedFile&& other){
+        if(this != &other){
+            close();
+            swap(other);
+        }
+        return *this;
+    };
+
+    ~MappedFile(){
+        close();
+    };
+
+    void swap(MappedFile& other){
+        std::swap(base, other.base);
+        std::swap(len, other.len);
+        std::swap(writable, other.writable);
+#ifdef _WIN32
+        std::swap(file, other.file);
+        std::swap(mapping, other.mapping);
+#else
+        std::swap(fd, other.fd);
+#endif
+    };
+
+    void* data()const{return base;};
+    std::size_t size()const{return len;};
+    bool isWritable()const{return writable;};
+    explicit operator bool()const{return base != nullptr;};
+
+    // write dirty pages of [offset, offset + bytes) back to the file, the whole mapping by default
+    void flush(std::size_t offset=0, std::size_t bytes=~std::size_t(0)){
+        if(!base || !writable)return;
+        bytes = std::min(bytes, len - offset);
+#ifdef _WIN32
+        FlushViewOfFile(static_cast<char*>(base) + offset, bytes);
+        FlushFileBuffers(file);
+#else
+        // msync wants a page-aligned start
+        std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        std::size_t start = offset / page * page;
+        ::msync(static_cast<char*>(base) + start, bytes + (offset - start), MS_SYNC);
+#endif
+    };
+
+    // hint that [offset, offset + bytes) is read front to back
+    void adviseSequential(std::size_t offset=0, std::size_t bytes=~std::size_t(0)){
+#ifndef _WIN32
+        if(!base)return;
+        bytes = std::min(bytes, len - offset);
+        std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        std::size_t start = offset / page * page;
+        ::madvise(static_cast<char*>(base) + start, bytes + (offset - start), MADV_SEQUENTIAL);
+#else
+        (void)offset;
+        (void)bytes;
+#endif
+    };
+
+    void close(){
+#ifdef _WIN32
+        if(base)UnmapViewOfFile(base);
+        if(mapping)CloseHandle(mapping);
+        if(file != INVALID_HANDLE_VALUE)CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if(base)::munmap(base, len);
+        if(fd >= 0)::close(fd);
+        fd = -1;
+#endif
+        base = nullptr;
+        len = 0;
+    };
+};
@@ -0,0 +1,230 @@
+#pragma once
+
+// runs ECS systems on a ThreadPool, systems without conflicting component access run
+// at the same time. two systems conflict when one writes a type the other reads or writes,
+// the one registered first then runs first. structural changes go through
+// ComponentManager::commands(), they are applied after every frame.
+//
+//     SystemScheduler<CM> s(cm);
+//     s.add<Reads<Velocity>, Writes<Position>>("move", [](CM& cm){...});
+//     s.run();
+//     std::cout << s.report();
+
+#include <vector>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <sstream>
+#include <iomanip>
+#include <exception>
+#include <functional>
+#include <algorithm>
+
+#include "threadpool.hpp"
+#include "componentstats.hpp"
+
+template <typename ...T>
+struct Reads{};
+
+template <typename ...T>
+struct Writes{};
+
+template <typename CM>
+class SystemScheduler{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Timing{
+        double ready;   // microseconds since frame start, all dependencies done
+        double start;
+        double end;
+    };
+
+private:
+    struct System{
+        std::string name;
+        std::uint64_t reads;
+        std::uint64_t writes;
+        bool exclusive;
+        std::function<void(CM&)> fn;
+        std::vector<std::size_t> before;    // direct dependencies
+        std::vector<std::size_t> after;     // direct dependents
+    };
+
+    struct Frame{
+        std::vector<std::atomic<std::size_t>> remaining;
+        std::atomic<std::size_t> left;
+        std::exception_ptr error;
+        std::atomic<bool> failed{false};
+        Clock::time_point begin;
+        explicit Frame(std::size_t n):remaining(n), left(n){};
+    };
+
+    CM* cm;
+    ThreadPool* pool;
+    std::vector<System> systems;
+    std::vector<Timing> timings;
+    std::vector<std::size_t> critical;
+    double wall = 0, work = 0, span = 0;
+    bool built = false;
+
+    template <typename ...T>
+    static void collect(System& s, Reads<T...>){s.reads |= (std::uint64_t(0) | ... | CM::template accessBit<T>());};
+    template <typename ...T>
+    static void collect(System& s, Writes<T...>){s.writes |= (std::uint64_t(0) | ... | CM::template accessBit<T>());};
+
+    static bool conflict(const System& a, const System& b){
+        return a.exclusive || b.exclusive || (a.writes & (b.reads | b.writes)) || (b.writes & a.reads);
+    };
+
+    static Clock::duration toClock(double us){
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::micro>(us));
+    };
+
+    double since(const Frame& f)const{
+        return std::chrono::duration<double, std::micro>(Clock::now() - f.begin).count();
+    };
+
+    void launch(Frame& f, std::size_t i){
+        pool->submit([this, &f, i]{
+            Timing& t = timings[i];
+            t.start = since(f);
+            if(!f.failed.load(std::memory_order_relaxed)){
+                try{
+                    systems[i].fn(*cm);
+                }catch(...){
+                    if(!f.failed.exchange(true))f.error = std::current_exception();
+                }
+            }
+            t.end = since(f);
+            if constexpr (ComponentStatsEnabled)cm->trace().record(systems[i].name, "system", f.begin + toClock(t.start), f.begin + toClock(t.end));
+            for(std::size_t s : systems[i].after){
+                if(f.remaining[s].fetch_sub(1, std::memory_order_acq_rel) == 1){
+                    timings[s].ready = t.end;
+                    launch(f, s);
+                }
+            }
+            f.left.fetch_sub(1, std::memory_order_acq_rel);
+        });
+    };
+
+    // longest chain of measured durations through the DAG, registration order is topological
+    void analyze(){
+        std::vector<double> best(systems.size());
+        std::vector<std::size_t> from(systems.size(), ~std::size_t(0));
+        work = span = 0;
+        std::size_t tail = 0;
+        for(std::size_t i = 0; i < systems.size(); ++i){
+            double d = timings[i].end - timings[i].start;
+            work += d;
+            best[i] = d;
+            for(std::size_t p : systems[i].before){
+                if(best[p] + d > best[i]){
+                    best[i] = best[p] + d;
+                    from[i] = p;
+                }
+            }
+            if(best[i] > span){
+                span = best[i];
+                tail = i;
+            }
+        }
+        critical.clear();
+        for(std::size_t i = tail; i != ~std::size_t(0) && !systems.empty(); i = from[i])critical.push_back(i);
+        std::reverse(critical.begin(), critical.end());
+    };
+
+public:
+    explicit SystemScheduler(CM& cm, ThreadPool& pool=ThreadPool::global()):cm(&cm), pool(&pool){};
+
+    // Access lists the component types the system reads and writes, e.g. add<Reads<A>, Writes<B>>
+    template <typename ...Access, typename F>
+    std::size_t add(std::string name, F&& fn){
+        systems.push_back(System{std::move(name), 0, 0, false, std::forward<F>(fn), {}, {}});
+        (..., collect(systems.back(), Access{}));
+        built = false;
+        return systems.size() - 1;
+    };
+
+    // conflicts with every other system, e.g. for code touching the manager as a whole
+    template <typename F>
+    std::size_t addExclusive(std::string name, F&& fn){
+        systems.push_back(System{std::move(name), 0, 0, true, std::forward<F>(fn), {}, {}});
+        built = false;
+        return systems.size() - 1;
+    };
+
+    // conflict DAG, edges only from a system to the later ones it conflicts with
+    void build(){
+        for(auto& s : systems){
+            s.before.clear();
+            s.after.clear();
+        }
+        for(std::size_t j = 0; j < systems.size(); ++j){
+            for(std::size_t i = 0; i < j; ++i){
+                if(!conflict(systems[i], systems[j]))continue;
+                systems[j].before.push_back(i);
+                systems[i].after.push_back(j);
+            }
+        }
+        timings.assign(systems.size(), Timing{0, 0, 0});
+        built = true;
+    };
+
+    // one frame: every system once, then the pending command buffers. rethrows the first
+    // exception after the running systems finished, later systems are skipped
+    void run(){
+        if(!built)build();
+        if(systems.empty())return;
+        Frame f(systems.size());
+        for(std::size_t i = 0; i < systems.size(); ++i)f.remaining[i].store(systems[i].before.size(), std::memory_order_relaxed);
+        f.begin = Clock::now();
+        for(std::size_t i = 0; i < systems.size(); ++i){
+            if(systems[i].before.empty()){
+                timings[i].ready = 0;
+                launch(f, i);
+            }
+        }
+        pool->helpUntil([&]{return f.left.load(std::memory_order_acquire) == 0;});
+        wall = since(f);
+        analyze();
+        if constexpr (ComponentStatsEnabled)cm->trace().record("frame", "frame", f.begin, Clock::now());
+        if(f.error)std::rethrow_exception(f.error);
+        cm->applyCommands();
+    };
+
+    std::size_t size()const{return systems.size();};
+    const std::string& name(std::size_t i)const{return systems[i].name;};
+    const std::vector<std::size_t>& dependencies(std::size_t i)const{return systems[i].before;};
+    // of the last frame
+    const Timing& timing(std::size_t i)const{return timings[i];};
+    const std::vector<std::size_t>& criticalPath()const{return critical;};
+    double wallTime()const{return wall;};
+    double workTime()const{return work;};
+    double criticalTime()const{return span;};
+
+    // last frame per system: ready / start / end times, time spent waiting for a thread
+    // after the dependencies were done, marks on the critical path. parallelism lost to
+    // dependencies shows as a long critical path, lost to threads as waits
+    std::string report()const{
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(1);
+        os << "frame " << wall << "us, work " << work << "us, critical path " << span << "us, parallelism "
+           << (wall > 0 ? work / wall : 0) << " (max " << (span > 0 ? work / span : 0) << ")\n";
+        for(std::size_t i = 0; i < systems.size(); ++i){
+            const Timing& t = timings[i];
+            bool onPath = std::find(critical.begin(), critical.end(), i) != critical.end();
+            os << (onPath ? " * " : "   ") << std::left << std::setw(24) << systems[i].name << std::right
+               << " start " << std::setw(9) << t.start << " took " << std::setw(9) << t.end - t.start
+               << " waited " << std::setw(9) << t.start - t.ready;
+            if(!systems[i].before.empty()){
+                os << " after";
+                for(std::size_t p : systems[i].before)os << ' ' << systems[p].name;
+            }
+            os << '\n';
+        }
+        return os.str();
+    };
+};
@@ -0,0 +1,191 @@
+#pragma once
+
+// persistent work-stealing thread pool.
+// every worker owns a deque, it pops its own tasks from the back and steals from the front
+// of the others when empty. the thread calling parallelFor takes part in the work, so the
+// pool also behaves on a single core and nested parallelFor calls do not deadlock.
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+
+class ThreadPool{
+public:
+    using Task = std::function<void()>;
+
+private:
+    struct Worker{
+        std::mutex m;
+        std::deque<Task> q;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<std::size_t> pending{0};
+    std::atomic<std::size_t> next{0};
+    bool stopping = false;
+
+    struct Current{
+        const ThreadPool* pool = nullptr;
+        std::size_t index = 0;
+    };
+    static Current& current(){
+        thread_local Current c;
+        return c;
+    };
+
+    // index of the worker running on this thread, ~0 outside this pool
+    std::size_t self()const{
+        const Current& c = current();
+        return c.pool == this ? c.index : ~std::size_t(0);
+    };
+
+    bool pop(std::size_t w, Task& t){
+        Worker& own = *workers[w];
+        std::lock_guard<std::mutex> lock(own.m);
+        if(own.q.empty())return false;
+        t = std::move(own.q.back());
+        own.q.pop_back();
+        return true;
+    };
+
+    bool steal(std::size_t from, Task& t){
+        for(std::size_t k = 0; k < workers.size(); ++k){
+            Worker& other = *workers[(from + k) % workers.size()];
+            std::lock_guard<std::mutex> lock(other.m);
+            if(other.q.empty())continue;
+            t = std::move(other.q.front());
+            other.q.pop_front();
+            return true;
+        }
+        return false;
+    };
+
+    // runs one queued task, false when every deque is empty
+    bool runOne(){
+        if(workers.empty())return false;
+        Task t;
+        std::size_t w = self();
+        if(w < workers.size() ? !pop(w, t) && !steal(w + 1, t) : !steal(next++ % workers.size(), t))return false;
+        pending.fetch_sub(1, std::memory_order_relaxed);
+        t();
+        return true;
+    };
+
+    void loop(std::size_t w){
+        current() = Current{this, w};
+        for(;;){
+            if(runOne())continue;
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this]{return stopping || pending.load() != 0;});
+            if(stopping && pending.load() == 0)return;
+        }
+    };
+
+public:
+    // threads - 1 workers, the caller of parallelFor is the last participant
+    explicit ThreadPool(std::size_t threads=std::max(1u, std::thread::hardware_concurrency())){
+        for(std::size_t i = 1; i < threads; ++i)workers.emplace_back(new Worker);
+        for(std::size_t i = 0; i < workers.size(); ++i)this->threads.emplace_back([this, i]{loop(i);});
+    };
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool(){
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(auto& t : threads)t.join();
+    };
+
+    static ThreadPool& global(){
+        static ThreadPool pool;
+        return pool;
+    };
+
+    // participants of parallelFor, workers plus the calling thread
+    std::size_t size()const{return workers.size() + 1;};
+
+    // queue a task, on the current worker's deque when called from inside the pool.
+    // with no workers it runs inline
+    void submit(Task t, std::size_t worker=~std::size_t(0)){
+        if(workers.empty())return t();
+        std::size_t w = worker != ~std::size_t(0) ? worker % workers.size() : (self() < workers.size() ? self() : next++ % workers.size());
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            pending.fetch_add(1, std::memory_order_relaxed);
+        }
+        {
+            std::lock_guard<std::mutex> lock(workers[w]->m);
+            workers[w]->q.push_back(std::move(t));
+        }
+        wake.notify_one();
+    };
+
+    // run queued tasks on the calling thread until done() holds
+    template <typename Pred>
+    void helpUntil(Pred&& done){
+        while(!done()){
+            if(!runOne())std::this_thread::yield();
+        }
+    };
+
+    // fn(begin, end, chunk) over [0, n) in chunks of grain indexes, blocks until all ran.
+    // chunk boundaries depend on n and grain only. deterministic: part p of size() parts runs
+    // chunks p, p + parts, p + 2 parts ... in that order on one thread, so per-part results
+    // are reproducible. otherwise each chunk is a task and idle workers steal.
+    // the first exception is rethrown
+    template <typename F>
+    void parallelFor(std::size_t n, std::size_t grain, F&& fn, bool deterministic=false){
+        if(n == 0)return;
+        grain = std::max<std::size_t>(grain, 1);
+        std::size_t chunks = (n + grain - 1) / grain;
+        auto run = [&](std::size_t c){fn(c * grain, std::min(n, (c + 1) * grain), c);};
+        if(workers.empty() || chunks == 1){
+            for(std::size_t c = 0; c < chunks; ++c)run(c);
+            return;
+        }
+        std::atomic<std::size_t> left;
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        auto guarded = [&](auto&& body){
+            try{
+                body();
+            }catch(...){
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if(!error)error = std::current_exception();
+            }
+            left.fetch_sub(1, std::memory_order_acq_rel);
+        };
+        if(deterministic){
+            std::size_t parts = std::min(chunks, size());
+            left = parts;
+            auto part = [&](std::size_t p){
+                guarded([&]{for(std::size_t c = p; c < chunks; c += parts)run(c);});
+            };
+            for(std::size_t p = 1; p < parts; ++p)submit([&part, p]{part(p);}, p - 1);
+            part(0);
+            helpUntil([&]{return left.load(std::memory_order_acquire) == 0;});
+        }else{
+            left = chunks;
+            // pushed back to front, owners pop their lowest chunk first
+            for(std::size_t c = chunks; c-- > 1;)submit([&guarded, &run, c]{guarded([&]{run(c);});});
+            guarded([&]{run(0);});
+            helpUntil([&]{return left.load(std::memory_order_acquire) == 0;});
+        }
+        if(error)std::rethrow_exception(error);
+    };
+};